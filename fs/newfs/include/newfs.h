@@ -9,12 +9,17 @@
 #include "string.h"
 #include "fuse.h"
 #include <stddef.h>
+#include <pthread.h>
+#include <time.h>
 #include "ddriver.h"
 #include "errno.h"
 #include "types.h"
 
 #define NEWFS_MAGIC_NUM 0x52415453 /* TODO: Define by yourself */
+#define NEWFS_JOURNAL_MAGIC 0x4C4E524A /* 日志超级块、描述块、提交块共用 */
 #define NEWFS_DEFAULT_PERM 0777	   /* 全权限打开 */
+#define NEWFS_ATTR_TIMEOUT "60.0"  /* 内核缓存属性/目录项（含不存在的项）的秒数 */
+#define NEWFS_MAX_XFER "8192"	   /* 单个读写请求的字节数上限：单文件至多NEWFS_DATA_PER_FILE块（6 KiB），取整到4 KiB页 */
 
 /******************************************************************************
  * SECTION: macro debug
@@ -24,6 +29,12 @@
 	{                                             \
 		printf("NEWFS_DBG: " fmt, ##__VA_ARGS__); \
 	} while (0)
+#define NEWFS_TREE_RDLOCK() pthread_rwlock_rdlock(&newfs_super.tree_lock)
+#define NEWFS_TREE_WRLOCK() pthread_rwlock_wrlock(&newfs_super.tree_lock)
+#define NEWFS_TREE_UNLOCK() pthread_rwlock_unlock(&newfs_super.tree_lock)
+#define NEWFS_INODE_RDLOCK(pinode) pthread_rwlock_rdlock(&(pinode)->lock)
+#define NEWFS_INODE_WRLOCK(pinode) pthread_rwlock_wrlock(&(pinode)->lock)
+#define NEWFS_INODE_UNLOCK(pinode) pthread_rwlock_unlock(&(pinode)->lock)
 /******************************************************************************
  * SECTION: newfs_utils.c
  *******************************************************************************/
@@ -32,17 +43,62 @@ int newfs_calc_lvl(const char *path);
 int newfs_driver_read(int offset, uint8_t *out_content, int size);
 int newfs_driver_write(int offset, uint8_t *in_content, int size);
 
+int newfs_format(int bytes_per_inode);
 int newfs_mount(struct custom_options options);
 int newfs_umount();
 
 int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry);
 struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry);
-void newfs_find_free_block(struct newfs_inode *inode, int bcnt);
+int newfs_find_free_block(struct newfs_inode *inode, int bcnt);
+void newfs_release_bno(int bno);
+uint8_t *newfs_load_block(struct newfs_inode *inode, int bcnt);
+int newfs_write_bufvec(struct newfs_inode *inode, struct fuse_bufvec *src, int offset);
+int newfs_write_data(struct newfs_inode *inode, const char *buf, int size, int offset);
+int newfs_read_data(struct newfs_inode *inode, char *buf, int size, int offset);
+void newfs_set_times(struct newfs_inode *inode, time_t atime, time_t mtime);
+int newfs_ra_update(struct newfs_file *file, int offset, int size, boolean is_miss);
+void newfs_readahead(struct newfs_inode *inode, struct newfs_file *file, int offset, int size);
 int newfs_sync_inode(struct newfs_inode *inode);
+void newfs_mark_dirty(struct newfs_inode *inode);
+int newfs_sync_fs();
+int newfs_start_writeback();
+void newfs_stop_writeback();
+void newfs_inode_get(struct newfs_inode *inode);
+void newfs_inode_put(struct newfs_inode *inode);
+void newfs_cache_shrink();
 struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino);
+int newfs_read_dir_inodes(struct newfs_inode *inode);
 struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir);
+boolean newfs_dentry_d_valid(struct newfs_dentry_d *dentry_d, int offset);
+int newfs_dir_find(struct newfs_inode *inode, const char *fname, boolean can_load,
+				   struct newfs_dentry **dentry_out);
+boolean newfs_dir_is_loaded(struct newfs_inode *inode);
+boolean newfs_is_cached(struct newfs_inode *inode, int offset, int size);
+int newfs_dir_lookup(struct newfs_inode *inode, const char *fname, struct newfs_dentry **child_out);
+int newfs_dir_create(struct newfs_dentry *parent, const char *fname, NEWFS_FILE_TYPE ftype,
+					 struct newfs_dentry **dentry_out);
+void newfs_fill_stat(struct newfs_dentry *, struct stat *);
+void newfs_fill_statfs(struct statvfs *st);
 
 struct newfs_dentry *newfs_lookup(const char *path, boolean *is_find, boolean *is_root);
+/******************************************************************************
+ * SECTION: newfs_bitmap.c
+ *******************************************************************************/
+int newfs_bitmap_find(const uint8_t *map, int from, int cnt);
+int newfs_bitmap_run(const uint8_t *map, int bit, int cnt, int max);
+int newfs_bitmap_count(const uint8_t *map, int cnt);
+/******************************************************************************
+ * SECTION: newfs_journal.c
+ *******************************************************************************/
+int newfs_journal_format();
+int newfs_journal_load();
+int newfs_journal_peek();
+void newfs_journal_overlay(int offset, uint8_t *content, int size);
+int newfs_journal_write(int offset, uint8_t *in_content, int size);
+void newfs_journal_defer_free(int bno);
+int newfs_journal_commit();
+int newfs_journal_checkpoint();
+void newfs_journal_destroy();
 /******************************************************************************
  * SECTION: newfs.c
  *******************************************************************************/
@@ -57,14 +113,20 @@ int newfs_write(const char *, const char *, size_t, off_t,
 				struct fuse_file_info *);
 int newfs_read(const char *, char *, size_t, off_t,
 			   struct fuse_file_info *);
+int newfs_write_buf(const char *, struct fuse_bufvec *, off_t,
+					struct fuse_file_info *);
 int newfs_access(const char *, int);
 int newfs_unlink(const char *);
 int newfs_rmdir(const char *);
 int newfs_rename(const char *, const char *);
 int newfs_utimens(const char *, const struct timespec tv[2]);
 int newfs_truncate(const char *, off_t);
+int newfs_fsync(const char *, int, struct fuse_file_info *);
+int newfs_flush(const char *, struct fuse_file_info *);
+int newfs_statfs(const char *, struct statvfs *);
 
 int newfs_open(const char *, struct fuse_file_info *);
+int newfs_release(const char *, struct fuse_file_info *);
 int newfs_opendir(const char *, struct fuse_file_info *);
 /******************************************************************************
  * SECTION: newfs_debug.c
@@ -23,6 +23,8 @@ typedef enum newfs_file_type
 
 #define NEWFS_SUPER_OFS 0
 #define NEWFS_ROOT_INO 0
+#define NEWFS_INVALID_BNO -1 /* 数据块尚未分配 */
+#define NEWFS_LAYOUT_VERSION 7 /* 磁盘格式版本，不一致时拒绝挂载 */
 
 #define NEWFS_ERROR_NONE 0
 #define NEWFS_ERROR_ACCESS EACCES
@@ -34,16 +36,41 @@ typedef enum newfs_file_type
 #define NEWFS_ERROR_UNSUPPORTED ENXIO
 #define NEWFS_ERROR_IO EIO       /* Error Input/Output */
 #define NEWFS_ERROR_INVAL EINVAL /* Invalid Args */
+#define NEWFS_ERROR_FBIG EFBIG   /* 超出单文件最大长度 */
+#define NEWFS_ERROR_NOTDIR ENOTDIR
 
 #define NEWFS_MAX_FILE_NAME 128
 #define NEWFS_INODE_PER_FILE 1
 #define NEWFS_DATA_PER_FILE 6
+#define NEWFS_INODE_D_SZ 128 /* 磁盘inode定长，多个inode共享一个块 */
+#define NEWFS_INLINE_DATA_SZ (NEWFS_INODE_D_SZ - 32) /* 不超过该大小的文件/软链接直接存于inode */
+#define NEWFS_INODE_BATCH 16 /* readdir预读子inode时单次合并读的最大块数 */
+#define NEWFS_WRITEBACK_INTERVAL 5 /* 后台回写线程的周期，单位秒 */
+#define NEWFS_DEFAULT_BYTES_PER_INODE 8192 /* 每多少字节设备空间配一个inode，mkfs.newfs -i可调 */
+#define NEWFS_JOURNAL_MIN_BLKS 64   /* 日志区按设备块数的1/32取，限制在[MIN, MAX]内 */
+#define NEWFS_JOURNAL_MAX_BLKS 8192
+#define NEWFS_JOURNAL_HASH 256      /* 日志块缓存的hash桶数 */
+#define NEWFS_JOURNAL_BATCH 64      /* 脏inode达到该数目时提前唤醒回写线程提交事务 */
+#define NEWFS_RA_INIT 2             /* 打开文件后首次顺序读的预读块数，顺序命中时翻倍 */
+#define NEWFS_RA_MAX NEWFS_DATA_PER_FILE
+#define NEWFS_SLAB_CHUNK 16384      /* slab每次向系统申请的字节数 */
+#define NEWFS_ARENA_MIN 256         /* 目录名字arena首块的字节数，之后每块翻倍 */
+#define NEWFS_ARENA_MAX 4096
+#define NEWFS_DENTRY_CAP_MIN 8      /* 目录项数组首次分配的容量，之后翻倍 */
+#define NEWFS_CACHE_KB 1024         /* inode/目录项/数据块缓存的默认内存预算，--cache_kb=调整，0为不限 */
 
 #define NEWFS_IOC_MAGIC 'S'
 #define NEWFS_IOC_SEEK _IO(NEWFS_IOC_MAGIC, 0)
 
 #define NEWFS_FLAG_BUF_DIRTY 0x1
 #define NEWFS_FLAG_BUF_OCCUPY 0x2
+
+#define NEWFS_INODE_FLAG_INLINE 0x1 /* newfs_inode_d.flags: 数据存于inline_data */
+#define NEWFS_INODE_FLAG_INDEX 0x2  /* newfs_inode_d.flags: 目录为hash索引，bno[0]为索引根 */
+#define NEWFS_DX_MAX_LEVELS 2       /* 索引根之下至多再有一层中间节点 */
+
+#define NEWFS_JOURNAL_DESC 1   /* 描述块：列出其后各数据块的原位块号 */
+#define NEWFS_JOURNAL_COMMIT 2 /* 提交块：校验和正确时事务才算完整 */
 /******************************************************************************
  * SECTION: Macro Function
  *******************************************************************************/
@@ -56,10 +83,19 @@ typedef enum newfs_file_type
 #define NEWFS_ROUND_UP(value, round) (value % round == 0 ? value : (value / round + 1) * round)
 
 #define NEWFS_BLKS_SZ(blks) (blks * NEWFS_BLOCK_SZ())
-#define NEWFS_ASSIGN_FNAME(pnewfs_dentry, _fname) \
-    memcpy(pnewfs_dentry->fname, _fname, strlen(_fname))
-#define NEWFS_INO_OFS(ino) (newfs_super.inode_offset + NEWFS_BLKS_SZ(ino))
-#define NEWFS_DATA_OFS(ino) (newfs_super.data_offset + NEWFS_BLKS_SZ(ino))
+#define NEWFS_INODE_PER_BLK() (NEWFS_BLOCK_SZ() / NEWFS_INODE_D_SZ)
+#define NEWFS_BLKS_PER_GROUP() (NEWFS_BLOCK_SZ() * UINT8_BITS) /* 一个位图块恰好管理一组 */
+#define NEWFS_GROUP_OFS(group) ((group) * NEWFS_BLKS_SZ(newfs_super.blks_per_group))
+#define NEWFS_INO_GROUP(ino) ((ino) / newfs_super.inodes_per_group)
+#define NEWFS_BNO_GROUP(bno) ((bno) / newfs_super.data_per_group)
+#define NEWFS_INO_OFS(ino) (NEWFS_GROUP_OFS(NEWFS_INO_GROUP(ino)) + newfs_super.inode_offset + \
+                            ((ino) % newfs_super.inodes_per_group) * NEWFS_INODE_D_SZ)
+#define NEWFS_DATA_OFS(bno) (NEWFS_GROUP_OFS(NEWFS_BNO_GROUP(bno)) + newfs_super.data_offset + \
+                             NEWFS_BLKS_SZ(((bno) % newfs_super.data_per_group)))
+#define NEWFS_DX_LIMIT() ((NEWFS_BLOCK_SZ() - sizeof(struct newfs_dx_node)) / sizeof(struct newfs_dx_entry))
+#define NEWFS_JOURNAL_OFS(pos) (newfs_super.journal.offset + NEWFS_BLKS_SZ((1 + (pos)))) /* 第0块为日志超级块 */
+#define NEWFS_JOURNAL_PER_DESC() ((NEWFS_BLOCK_SZ() - sizeof(struct newfs_journal_header_d)) / sizeof(int32_t))
+#define NEWFS_DENTRY_REC_LEN(name_len) (NEWFS_ROUND_UP((sizeof(struct newfs_dentry_d) + (name_len)), 4))
 
 #define NEWFS_IS_DIR(pinode) (pinode->dentry->ftype == NEWFS_DIR)
 #define NEWFS_IS_REG(pinode) (pinode->dentry->ftype == NEWFS_REG_FILE)
@@ -71,32 +107,122 @@ struct newfs_dentry;
 struct newfs_inode;
 struct newfs_super;
 
+/* 定长对象的slab：成块向系统申请，释放的对象挂入空闲链表复用，卸载时整体归还 */
+struct newfs_slab
+{
+    size_t obj_sz;
+    void *free_list; /* 空闲对象的头部存放下一个空闲对象 */
+    void *chunks;    /* 每块的头部存放下一块 */
+    pthread_mutex_t lock;
+};
+
+struct newfs_arena_chunk
+{
+    struct newfs_arena_chunk *next;
+    int size;
+    char data[];
+};
+
+/* 名字arena：同一目录下各项的文件名紧密排在一起，只整体释放（目录被淘汰或卸载时） */
+struct newfs_arena
+{
+    struct newfs_arena_chunk *chunks; /* 最新的块在头部 */
+    int used;                         /* 头部块已用的字节数 */
+};
+
 struct custom_options
 {
     const char *device;
     boolean show_help;
+    int cache_kb; /* 缓存预算，超出后回写线程淘汰最久未用的干净inode */
 };
 
 struct newfs_inode
 {
     int ino;                               /* 在inode位图中的下标 */
     int size;                              /* 文件已占用空间 */
+    time_t atime;
+    time_t mtime;                          /* 内容或目录项改变时更新 */
+    time_t ctime;                          /* mtime或atime被设置时一并更新 */
     char target_path[NEWFS_MAX_FILE_NAME]; /* store traget path when it is a symlink */
     int dir_cnt;
+    boolean is_indexed;  /* 目录以hash索引组织 */
+    boolean is_complete; /* dentrys已包含全部目录项；索引目录按需加载时为FALSE */
+    int dirty_from;                                   /* 自上次回写后最早改动的目录项（按磁盘顺序） */
     struct newfs_dentry *dentry;                      /* 指向该inode的dentry */
-    struct newfs_dentry *dentrys;                     /* 所有目录项 */
+    struct newfs_dentry **dentrys;                    /* 目录项，非索引目录按磁盘顺序；新建的总在末尾 */
+    uint32_t *hashes;                                 /* 与dentrys一一对应的文件名hash，查找先比它 */
+    int dentry_cnt;                                   /* 内存中的目录项数，索引目录未整体读入时少于dir_cnt */
+    int unloaded_cnt;                                 /* dentrys中子inode尚未装入或已被淘汰的项数 */
+    int dentry_cap;
+    struct newfs_arena names;                         /* dentrys的文件名，受本inode的锁保护 */
     uint8_t *data_block_pointer[NEWFS_DATA_PER_FILE]; /*数据块指针*/
     int bno[NEWFS_DATA_PER_FILE];                     /*数据块块号*/
+    flag16 block_flag[NEWFS_DATA_PER_FILE];           /* NEWFS_FLAG_BUF_OCCUPY / NEWFS_FLAG_BUF_DIRTY */
+    boolean is_dirty;                                 /* 自上次回写后被修改过 */
+    struct newfs_inode *dirty_prev;                   /* 脏inode链表 */
+    struct newfs_inode *dirty_next;
+    int refcnt;                                       /* 打开文件/低层接口节点表的引用，非零时不淘汰 */
+    struct newfs_inode *lru_prev;                     /* 缓存链表，最近访问的在头部；根inode不在其中 */
+    struct newfs_inode *lru_next;
+    pthread_rwlock_t lock; /* 保护数据缓存、大小；目录还保护dentrys数组及其中dentry->inode的装入 */
+};
+
+/* 打开文件的私有状态，由newfs_open分配并存于fi->fh */
+struct newfs_file
+{
+    struct newfs_inode *inode; /* 路径接口open时查到并钉住，flush不必重新查找 */
+    int next_offset; /* 上一次读结束的位置，下一次从这里开始即为顺序读 */
+    int ra_window; /* 当前预读窗口（块），随机读时归零 */
+    pthread_mutex_t ra_lock; /* next_offset与ra_window：命中缓存的读只持inode读锁，同一文件上可并发 */
 };
 
 struct newfs_dentry
 {
-    char fname[NEWFS_MAX_FILE_NAME];
-    struct newfs_dentry *parent;  /* 父亲Inode的dentry */
-    struct newfs_dentry *brother; /* 兄弟 */
     int ino;
-    struct newfs_inode *inode; /* 指向inode */
     NEWFS_FILE_TYPE ftype;
+    struct newfs_inode *inode;   /* 指向inode */
+    struct newfs_dentry *parent; /* 父亲Inode的dentry */
+    char *fname;                 /* 存于父目录inode的names */
+};
+
+/* 一次索引插入改动过的块：改动先留在内存，全部成功后才写入日志，失败时整批丢弃 */
+struct newfs_dx_stage
+{
+    int *bnos;
+    uint8_t **blocks;
+    boolean *is_new; /* 本次新分配的块，失败时归还 */
+    int cnt;
+    int max;
+};
+
+/* 日志块缓存项：元数据写先落在这里，提交时整体写入日志，检查点时才写回原位 */
+struct newfs_jblock
+{
+    int blk;              /* 设备上的绝对块号 */
+    uint8_t *data;        /* 最新内容，读路径以它覆盖磁盘内容 */
+    uint8_t *ckpt;        /* in_txn且is_committed时保存已提交的旧内容 */
+    boolean in_txn;       /* 在当前未提交事务中被修改 */
+    boolean is_committed; /* 已提交进日志、尚未写回原位 */
+    struct newfs_jblock *next;
+};
+
+struct newfs_journal
+{
+    boolean is_enabled; /* 挂载并完成回放后才启用，格式化时直接写盘 */
+    int offset;         /* 日志区起点，位于所有块组之后 */
+    int blks;           /* 含日志超级块，其余为循环使用的记录区 */
+    int head;           /* 最早一个未检查点事务在记录区中的位置 */
+    int tail;           /* 下一个事务的写入位置 */
+    uint32_t seq;       /* 下一个事务的序号 */
+    uint32_t head_seq;  /* head处事务的序号 */
+    int cached_cnt;
+    int txn_cnt;
+    struct newfs_jblock *buckets[NEWFS_JOURNAL_HASH];
+    int *pending_free;   /* 已释放但在检查点前不能复用的数据块 */
+    int pending_cnt;
+    int pending_committed; /* pending_free的前这么多项已随事务提交 */
+    int pending_max;
 };
 
 struct newfs_super
@@ -109,41 +235,59 @@ struct newfs_super
 
     int max_ino;
     int max_data;
+    int free_ino;  /* 随每次占用与释放增减，statfs直接取用 */
+    int free_data;
 
-    uint8_t *map_inode;
+    uint8_t *map_inode; /* 各组位图首尾相接，第g组占第g块 */
     uint8_t *map_data;
     int map_inode_blks;
     int map_data_blks;
 
-    int map_inode_offset;
+    int map_inode_offset; /* 以下偏移均相对于所在组的起点 */
     int map_data_offset;
 
     int inode_offset;
     int data_offset;
 
+    int groups_cnt;
+    int blks_per_group;
+    int inodes_per_group;
+    int data_per_group;    /* 末组可能不足，以max_data为准 */
+    boolean *group_dirty;  /* 位图待回写的组 */
+
     boolean is_mounted;
+    boolean is_super_dirty; /* 位图或超级块待回写 */
 
     struct newfs_dentry *root_dentry;
+    struct newfs_inode *dirty_inodes; /* 待回写的inode，回写只处理这些 */
+    int dirty_cnt;
+    struct newfs_inode *lru_head;     /* 已装入的非根inode，按最近访问排序 */
+    struct newfs_inode *lru_tail;
+    long cache_bytes;                 /* inode、目录项与数据块缓存占用的内存 */
+    long cache_budget;                /* 为0时不淘汰 */
+    long cache_kick;                  /* 占用超过它时唤醒回写线程，每次淘汰后重设 */
+    struct newfs_journal journal;
+
+    /* 加锁顺序：tree_lock -> inode->lock（路径上自上而下，同时至多持有一个目录的锁）
+     * -> bitmap_lock / dirty_lock / cache_lock / slab锁 -> driver_lock */
+    pthread_rwlock_t tree_lock;   /* 普通操作共享持有；回写与日志提交独占 */
+    pthread_mutex_t bitmap_lock;  /* 位图、free_ino/free_data、group_dirty、is_super_dirty */
+    pthread_mutex_t dirty_lock;   /* 脏inode链表与dirty_cnt */
+    pthread_mutex_t cache_lock;   /* 缓存链表、cache_bytes与refcnt；淘汰本身在独占tree_lock时进行 */
+    pthread_mutex_t driver_lock;  /* ddriver的seek与读写须成对执行 */
+    pthread_mutex_t writeback_lock; /* 只配合writeback_cond使用 */
+    pthread_cond_t writeback_cond;
+    pthread_t writeback_thread;
+    boolean writeback_stop;
 };
 
-static inline struct newfs_dentry *new_dentry(char *fname, NEWFS_FILE_TYPE ftype)
-{
-    struct newfs_dentry *dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry));
-    memset(dentry, 0, sizeof(struct newfs_dentry));
-    NEWFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype = ftype;
-    dentry->ino = -1;
-    dentry->inode = NULL;
-    dentry->parent = NULL;
-    dentry->brother = NULL;
-    return dentry;
-}
 /******************************************************************************
  * SECTION: FS Specific Structure - Disk structure
  *******************************************************************************/
 struct newfs_super_d
 {
     uint32_t magic_num;
+    uint32_t version;
     int sz_usage;
 
     int max_ino;
@@ -157,23 +301,82 @@ struct newfs_super_d
 
     int inode_offset;
     int data_offset;
+
+    int groups_cnt;
+    int blks_per_group;
+    int inodes_per_group;
+    int data_per_group;
+
+    int journal_offset;
+    int journal_blks;
+
+    int free_ino; /* 与位图在同一事务中落盘 */
+    int free_data;
 };
 
+/* 定长NEWFS_INODE_D_SZ字节；小文件与短软链接的内容直接放在块号区域，
+ * 较长的软链接目标路径存放于其bno[0]数据块 */
 struct newfs_inode_d
 {
-    int ino;                               /* 在inode位图中的下标 */
-    int size;                              /* 文件已占用空间 */
-    char target_path[NEWFS_MAX_FILE_NAME]; /* store traget path when it is a symlink */
-    int dir_cnt;
-    NEWFS_FILE_TYPE ftype;
-    int bno[NEWFS_DATA_PER_FILE];
+    uint32_t ino;  /* 在inode位图中的下标 */
+    uint32_t size; /* 文件已占用空间 */
+    uint32_t dir_cnt;
+    uint16_t ftype; /* NEWFS_FILE_TYPE */
+    uint16_t flags; /* NEWFS_INODE_FLAG_* */
+    uint32_t atime; /* 秒；读不更新atime，只随utimens与创建改变 */
+    uint32_t mtime;
+    uint32_t ctime;
+    uint32_t reserved;
+    union
+    {
+        int32_t bno[NEWFS_DATA_PER_FILE];
+        uint8_t inline_data[NEWFS_INLINE_DATA_SZ]; /* flags含NEWFS_INODE_FLAG_INLINE时有效 */
+    };
 };
 
+/* 变长目录项，记录不跨块；块内最后一条记录的rec_len延伸到块尾，name_len为0的记录是空闲空间 */
 struct newfs_dentry_d
 {
-    char fname[NEWFS_MAX_FILE_NAME];
-    NEWFS_FILE_TYPE ftype;
-    int ino; /* 指向的ino号 */
+    uint32_t ino;     /* 指向的ino号 */
+    uint16_t rec_len; /* 本记录总长，含名字及4字节对齐填充 */
+    uint8_t name_len;
+    uint8_t ftype; /* NEWFS_FILE_TYPE */
+    char fname[];  /* 不含'\0' */
+};
+
+/* 索引节点项：覆盖hash >= hash的目录项，直到下一项；首项hash为0 */
+struct newfs_dx_entry
+{
+    uint32_t hash;
+    int32_t bno; /* 下一层索引节点或目录叶块 */
+};
+
+/* 索引根与中间节点共用的块格式，叶块即普通的变长目录块 */
+struct newfs_dx_node
+{
+    uint16_t count;
+    uint8_t levels; /* 仅根有效：0为直接指向叶块，1为经过一层中间节点 */
+    uint8_t reserved[5];
+    struct newfs_dx_entry entries[];
+};
+
+/* 日志超级块，只在格式化、回放与检查点时更新 */
+struct newfs_journal_super_d
+{
+    uint32_t magic;
+    uint32_t seq; /* head处事务的序号 */
+    int32_t head;
+};
+
+/* 描述块与提交块共用的块头 */
+struct newfs_journal_header_d
+{
+    uint32_t magic;
+    uint16_t type;     /* NEWFS_JOURNAL_DESC / NEWFS_JOURNAL_COMMIT */
+    uint16_t count;    /* 描述块：其后数据块数；提交块：整个事务的数据块数 */
+    uint32_t seq;
+    uint32_t checksum; /* 仅提交块：事务内全部描述块与数据块的校验和 */
+    int32_t blocks[];  /* 仅描述块：各数据块的原位块号 */
 };
 
 #endif /* _TYPES_H_ */
\ No newline at end of file
@@ -0,0 +1,780 @@
+#include "../include/newfs.h"
+#include "fuse_lowlevel.h"
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define OPTION(t, p)                             \
+	{                                            \
+		t, offsetof(struct custom_options, p), 1 \
+	}
+#define NEWFS_LL_INO(ino) ((fuse_ino_t)(ino) + FUSE_ROOT_ID) /* newfs根inode为0，FUSE根节点号为1 */
+#define NEWFS_INO(ll_ino) ((int)((ll_ino) - FUSE_ROOT_ID))
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+/* 内核通过lookup拿到的节点，以newfs的ino为下标 */
+struct newfs_ll_node
+{
+	struct newfs_inode *inode;
+	uint64_t nlookup; /* 内核持有的引用数，lookup/mknod/mkdir加一，forget减去 */
+};
+
+static const struct fuse_opt option_spec[] = {/* 用于FUSE文件系统解析参数 */
+											  OPTION("--device=%s", device),
+											  OPTION("--cache_kb=%d", cache_kb),
+											  FUSE_OPT_END};
+
+struct custom_options newfs_options; /* 全局选项 */
+extern struct newfs_super newfs_super;
+
+static struct newfs_ll_node *newfs_ll_nodes;
+static pthread_mutex_t newfs_ll_lock = PTHREAD_MUTEX_INITIALIZER; /* 保护newfs_ll_nodes */
+static struct fuse_session *newfs_ll_session;
+static double newfs_ll_timeout; /* 内核缓存属性/目录项的秒数 */
+/******************************************************************************
+ * SECTION: 节点表
+ *******************************************************************************/
+/**
+ * @brief 由FUSE节点号取内存inode
+ *
+ * @param ino FUSE节点号
+ * @return struct newfs_inode* 未被lookup过的节点返回NULL
+ */
+static struct newfs_inode *newfs_ll_inode(fuse_ino_t ino)
+{
+	struct newfs_inode *inode = NULL;
+
+	pthread_mutex_lock(&newfs_ll_lock);
+	if (NEWFS_INO(ino) >= 0 && NEWFS_INO(ino) < newfs_super.max_ino)
+	{
+		inode = newfs_ll_nodes[NEWFS_INO(ino)].inode;
+	}
+	pthread_mutex_unlock(&newfs_ll_lock);
+	return inode;
+}
+/**
+ * @brief 减少内核持有的引用，减到0时放开对inode的引用，此后它可被淘汰
+ *
+ * @param ino newfs的inode号
+ * @param nlookup
+ */
+static void newfs_ll_unref(int ino, unsigned long nlookup)
+{
+	pthread_mutex_lock(&newfs_ll_lock);
+	newfs_ll_nodes[ino].nlookup -= nlookup;
+	if (newfs_ll_nodes[ino].nlookup == 0 && ino != NEWFS_ROOT_INO)
+	{
+		newfs_inode_put(newfs_ll_nodes[ino].inode);
+		newfs_ll_nodes[ino].inode = NULL;
+	}
+	pthread_mutex_unlock(&newfs_ll_lock);
+}
+/**
+ * @brief 回复一个目录项，节点登记到节点表并增加引用；调用者需共享持有tree_lock
+ *
+ * @param req
+ * @param dentry inode已加载的dentry
+ */
+static void newfs_ll_reply_entry(fuse_req_t req, struct newfs_dentry *dentry)
+{
+	struct fuse_entry_param e;
+
+	memset(&e, 0, sizeof(struct fuse_entry_param));
+	NEWFS_INODE_RDLOCK(dentry->inode);
+	newfs_fill_stat(dentry, &e.attr);
+	NEWFS_INODE_UNLOCK(dentry->inode);
+	e.ino = NEWFS_LL_INO(dentry->ino);
+	e.attr.st_ino = e.ino;
+	e.attr_timeout = newfs_ll_timeout;
+	e.entry_timeout = newfs_ll_timeout;
+
+	pthread_mutex_lock(&newfs_ll_lock);
+	if (newfs_ll_nodes[dentry->ino].nlookup++ == 0)
+	{ /* 内核持有期间inode不被淘汰，节点表中的指针一直有效 */
+		newfs_ll_nodes[dentry->ino].inode = dentry->inode;
+		newfs_inode_get(dentry->inode);
+	}
+	pthread_mutex_unlock(&newfs_ll_lock);
+	if (fuse_reply_entry(req, &e) != 0)
+	{ /* 回复未送达，内核不会为此发forget */
+		newfs_ll_unref(dentry->ino, 1);
+	}
+}
+/**
+ * @brief 以页缓存中的块直接组成回复，不先拷贝到连续缓冲区；内核支持时libfuse经splice送出
+ *
+ * 调用者需持有inode的锁；读锁时本次范围必须已全部缓存（newfs_is_cached），
+ * 否则需持写锁，由newfs_load_block补读空洞或未缓存的块
+ *
+ * @param req
+ * @param inode 普通文件inode
+ * @param size
+ * @param off
+ */
+static void newfs_ll_reply_data(fuse_req_t req, struct newfs_inode *inode, size_t size, off_t off)
+{
+	struct fuse_bufvec *bufv;
+	int done, bcnt, ofs, len;
+	uint8_t *block;
+
+	if (off >= inode->size || size == 0)
+	{
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+	size = size < (size_t)(inode->size - off) ? size : (size_t)(inode->size - off);
+	bufv = (struct fuse_bufvec *)malloc(sizeof(struct fuse_bufvec) +
+										((size - 1) / NEWFS_BLOCK_SZ() + 1) * sizeof(struct fuse_buf));
+	memset(bufv, 0, sizeof(struct fuse_bufvec));
+	for (done = 0; done < (int)size; done += len)
+	{
+		bcnt = (off + done) / NEWFS_BLOCK_SZ();
+		ofs = (off + done) % NEWFS_BLOCK_SZ();
+		len = NEWFS_BLOCK_SZ() - ofs < (int)size - done ? NEWFS_BLOCK_SZ() - ofs : (int)size - done;
+		block = newfs_load_block(inode, bcnt);
+		if (block == NULL)
+		{
+			break;
+		}
+		bufv->buf[bufv->count].size = len;
+		bufv->buf[bufv->count].flags = 0;
+		bufv->buf[bufv->count].mem = block + ofs;
+		bufv->buf[bufv->count].fd = -1;
+		bufv->count++;
+	}
+	if (bufv->count == 0)
+	{
+		fuse_reply_err(req, NEWFS_ERROR_IO);
+	}
+	else
+	{
+		fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+	}
+	free(bufv);
+}
+/******************************************************************************
+ * SECTION: FUSE低层操作实现
+ *******************************************************************************/
+/**
+ * @brief 挂载（mount）文件系统，建立节点表
+ *
+ * @param userdata 可忽略
+ * @param conn 内核能力协商
+ */
+static void newfs_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	(void)userdata;
+	if (newfs_mount(newfs_options) != NEWFS_ERROR_NONE)
+	{
+		NEWFS_DBG("[%s] mount error\n", __func__);
+		fuse_session_exit(newfs_ll_session);
+		return;
+	}
+	newfs_ll_nodes = (struct newfs_ll_node *)calloc(newfs_super.max_ino, sizeof(struct newfs_ll_node));
+	newfs_ll_nodes[NEWFS_ROOT_INO].inode = newfs_super.root_dentry->inode;
+	newfs_ll_nodes[NEWFS_ROOT_INO].nlookup = 1; /* 根节点不经lookup，也不会被forget */
+	if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+	{ /* 读回复由页缓存经管道splice到设备 */
+		conn->want |= FUSE_CAP_SPLICE_WRITE | (conn->capable & FUSE_CAP_SPLICE_MOVE);
+	}
+	if (conn->capable & FUSE_CAP_SPLICE_READ)
+	{ /* 写请求的数据留在管道里，由newfs_ll_write_buf直接读进页缓存 */
+		conn->want |= FUSE_CAP_SPLICE_READ;
+	}
+	if (conn->capable & FUSE_CAP_BIG_WRITES)
+	{
+		conn->want |= FUSE_CAP_BIG_WRITES;
+	}
+#ifdef FUSE_CAP_WRITEBACK_CACHE
+	if (conn->capable & FUSE_CAP_WRITEBACK_CACHE)
+	{ /* 小写先在内核页缓存中合并，回写时才成批下发 */
+		conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+	}
+#endif
+	if (newfs_start_writeback() != NEWFS_ERROR_NONE)
+	{
+		NEWFS_DBG("[%s] writeback thread error\n", __func__);
+	}
+}
+
+/**
+ * @brief 卸载（umount）文件系统
+ *
+ * @param userdata 可忽略
+ */
+static void newfs_ll_destroy(void *userdata)
+{
+	(void)userdata;
+	if (newfs_ll_nodes == NULL)
+	{ /* 挂载失败 */
+		return;
+	}
+	newfs_stop_writeback();
+	if (newfs_umount() != NEWFS_ERROR_NONE)
+	{
+		NEWFS_DBG("[%s] unmount error\n", __func__);
+	}
+	free(newfs_ll_nodes);
+	newfs_ll_nodes = NULL;
+}
+
+/**
+ * @brief 在目录parent中按名字查找，只解析这一级
+ *
+ * @param req
+ * @param parent 父目录节点号
+ * @param name 文件名
+ */
+static void newfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	struct newfs_inode *dir;
+	struct newfs_dentry *child = NULL;
+	struct fuse_entry_param e;
+	int ret;
+
+	NEWFS_TREE_RDLOCK();
+	dir = newfs_ll_inode(parent);
+	if (dir == NULL)
+	{ /* 父节点不在节点表中，不是该名字不存在，不能让内核缓存否定项 */
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+	}
+	else if (!NEWFS_IS_DIR(dir))
+	{
+		fuse_reply_err(req, NEWFS_ERROR_NOTDIR);
+	}
+	else if ((ret = newfs_dir_lookup(dir, name, &child)) == NEWFS_ERROR_NONE)
+	{
+		newfs_ll_reply_entry(req, child);
+	}
+	else if (ret == -NEWFS_ERROR_NOTFOUND)
+	{ /* ino为0的回复让内核缓存“不存在”，重复查找同名项不再回调；读盘失败时不能这样回复 */
+		memset(&e, 0, sizeof(struct fuse_entry_param));
+		e.entry_timeout = newfs_ll_timeout;
+		fuse_reply_entry(req, &e);
+	}
+	else
+	{
+		fuse_reply_err(req, -ret);
+	}
+	NEWFS_TREE_UNLOCK();
+}
+
+/**
+ * @brief 内核释放nlookup个引用；inode仍留在内存中，引用归零只表示内核不再持有该节点号
+ *
+ * @param req
+ * @param ino 节点号
+ * @param nlookup 释放的引用数
+ */
+static void newfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	if (NEWFS_INO(ino) >= 0 && NEWFS_INO(ino) < newfs_super.max_ino)
+	{
+		newfs_ll_unref(NEWFS_INO(ino), nlookup);
+	}
+	fuse_reply_none(req);
+}
+
+/**
+ * @brief 获取文件或目录的属性
+ *
+ * @param req
+ * @param ino 节点号
+ * @param fi 可忽略
+ */
+static void newfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode;
+	struct stat st;
+	(void)fi;
+
+	NEWFS_TREE_RDLOCK();
+	inode = newfs_ll_inode(ino);
+	if (inode == NULL)
+	{
+		NEWFS_TREE_UNLOCK();
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	NEWFS_INODE_RDLOCK(inode);
+	newfs_fill_stat(inode->dentry, &st);
+	NEWFS_INODE_UNLOCK(inode);
+	NEWFS_TREE_UNLOCK();
+
+	st.st_ino = ino;
+	fuse_reply_attr(req, &st, newfs_ll_timeout);
+}
+
+/**
+ * @brief 修改属性：与路径接口一致，不支持改变大小，时间随inode落盘，权限等忽略
+ *
+ * @param req
+ * @param ino 节点号
+ * @param attr 新属性
+ * @param to_set FUSE_SET_ATTR_*
+ * @param fi 可忽略
+ */
+static void newfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+							 struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode;
+	time_t now = time(NULL);
+
+	if (to_set & FUSE_SET_ATTR_SIZE)
+	{
+		fuse_reply_err(req, ENOSYS);
+		return;
+	}
+	if (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))
+	{
+		NEWFS_TREE_RDLOCK();
+		inode = newfs_ll_inode(ino);
+		if (inode != NULL)
+		{
+			NEWFS_INODE_WRLOCK(inode);
+			newfs_set_times(inode,
+							!(to_set & FUSE_SET_ATTR_ATIME) ? inode->atime : (to_set & FUSE_SET_ATTR_ATIME_NOW) ? now : attr->st_atime,
+							!(to_set & FUSE_SET_ATTR_MTIME) ? inode->mtime : (to_set & FUSE_SET_ATTR_MTIME_NOW) ? now : attr->st_mtime);
+			NEWFS_INODE_UNLOCK(inode);
+		}
+		NEWFS_TREE_UNLOCK();
+	}
+	newfs_ll_getattr(req, ino, fi);
+}
+
+/**
+ * @brief mknod与mkdir共用：在父目录下新建一项并回复其目录项
+ *
+ * @param req
+ * @param parent 父目录节点号
+ * @param name 文件名
+ * @param ftype 文件类型
+ */
+static void newfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, NEWFS_FILE_TYPE ftype)
+{
+	struct newfs_inode *dir;
+	struct newfs_dentry *dentry;
+	int ret;
+
+	NEWFS_TREE_RDLOCK();
+	dir = newfs_ll_inode(parent);
+	if (dir == NULL)
+	{
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (!NEWFS_IS_DIR(dir))
+	{
+		ret = -NEWFS_ERROR_NOTDIR;
+	}
+	else
+	{
+		ret = newfs_dir_create(dir->dentry, name, ftype, &dentry);
+	}
+
+	if (ret == NEWFS_ERROR_NONE)
+	{
+		newfs_ll_reply_entry(req, dentry);
+	}
+	else
+	{
+		fuse_reply_err(req, -ret);
+	}
+	NEWFS_TREE_UNLOCK();
+}
+
+/**
+ * @brief 创建文件
+ *
+ * @param req
+ * @param parent 父目录节点号
+ * @param name 文件名
+ * @param mode 创建文件的模式，只区分目录与普通文件
+ * @param rdev 可忽略
+ */
+static void newfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
+{
+	(void)rdev;
+	newfs_ll_create(req, parent, name, S_ISDIR(mode) ? NEWFS_DIR : NEWFS_REG_FILE);
+}
+
+/**
+ * @brief 创建目录
+ *
+ * @param req
+ * @param parent 父目录节点号
+ * @param name 目录名
+ * @param mode 可忽略
+ */
+static void newfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	(void)mode;
+	newfs_ll_create(req, parent, name, NEWFS_DIR);
+}
+
+/**
+ * @brief 打开文件，在fi->fh中保存该次打开的顺序读检测与预读窗口
+ *
+ * @param req
+ * @param ino 节点号
+ * @param fi 文件信息
+ */
+static void newfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct newfs_file *file = (struct newfs_file *)malloc(sizeof(struct newfs_file));
+	(void)ino;
+
+	file->inode = NULL; /* 内核持有节点期间inode已由节点表钉住 */
+	file->next_offset = 0;
+	file->ra_window = NEWFS_RA_INIT / 2;
+	pthread_mutex_init(&file->ra_lock, NULL);
+	fi->fh = (uint64_t)(uintptr_t)file;
+	fi->keep_cache = 1; /* 修改都经由本挂载点，重复open不必丢弃内核页缓存 */
+	if (fuse_reply_open(req, fi) != 0)
+	{ /* open被中断，不会再有release */
+		pthread_mutex_destroy(&file->ra_lock);
+		free(file);
+	}
+}
+
+/**
+ * @brief 读文件：命中页缓存时持读锁并直接以缓存块回复
+ *
+ * @param req
+ * @param ino 节点号
+ * @param size 读取的字节数
+ * @param off 相对文件的偏移
+ * @param fi 文件信息
+ */
+static void newfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+						  struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode;
+	struct newfs_file *file = (struct newfs_file *)(uintptr_t)fi->fh;
+
+	NEWFS_TREE_RDLOCK();
+	inode = newfs_ll_inode(ino);
+	if (inode == NULL || NEWFS_IS_DIR(inode))
+	{
+		NEWFS_TREE_UNLOCK();
+		fuse_reply_err(req, inode == NULL ? NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_ISDIR);
+		return;
+	}
+	NEWFS_INODE_RDLOCK(inode);
+	if (!newfs_is_cached(inode, off, size))
+	{ /* 要读盘填充页缓存，换成写锁，预读也只在此时进行 */
+		NEWFS_INODE_UNLOCK(inode);
+		NEWFS_INODE_WRLOCK(inode);
+		newfs_readahead(inode, file, off, size);
+	}
+	else if (file)
+	{
+		newfs_ra_update(file, off, size, FALSE);
+	}
+	newfs_ll_reply_data(req, inode, size, off); /* 回复送出之前缓存块不能被改写 */
+	NEWFS_INODE_UNLOCK(inode);
+	NEWFS_TREE_UNLOCK();
+}
+
+/**
+ * @brief 写入文件
+ *
+ * @param req
+ * @param ino 节点号
+ * @param buf 写入的内容
+ * @param size 写入的字节数
+ * @param off 相对文件的偏移
+ * @param fi 可忽略
+ */
+static void newfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+						   struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode;
+	int ret;
+	(void)fi;
+
+	NEWFS_TREE_RDLOCK();
+	inode = newfs_ll_inode(ino);
+	if (inode == NULL)
+	{
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(inode))
+	{
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else
+	{
+		NEWFS_INODE_WRLOCK(inode);
+		ret = newfs_write_data(inode, buf, size, off);
+		NEWFS_INODE_UNLOCK(inode);
+	}
+	NEWFS_TREE_UNLOCK();
+
+	if (ret < 0)
+	{
+		fuse_reply_err(req, -ret);
+	}
+	else
+	{
+		fuse_reply_write(req, ret);
+	}
+}
+
+/**
+ * @brief 写入文件，内核启用splice时bufv指向管道，数据不经中间缓冲
+ *
+ * @param req
+ * @param ino 节点号
+ * @param bufv 写入的内容
+ * @param off 相对文件的偏移
+ * @param fi 可忽略
+ */
+static void newfs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off,
+							   struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode;
+	int ret;
+	(void)fi;
+
+	NEWFS_TREE_RDLOCK();
+	inode = newfs_ll_inode(ino);
+	if (inode == NULL)
+	{
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(inode))
+	{
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else
+	{
+		NEWFS_INODE_WRLOCK(inode);
+		ret = newfs_write_bufvec(inode, bufv, off);
+		NEWFS_INODE_UNLOCK(inode);
+	}
+	NEWFS_TREE_UNLOCK();
+
+	if (ret < 0)
+	{
+		fuse_reply_err(req, -ret);
+	}
+	else
+	{
+		fuse_reply_write(req, ret);
+	}
+}
+
+/**
+ * @brief 关闭文件时调用，只回写该文件本身的inode，其余修改交给后台回写
+ *
+ * @param req
+ * @param ino 节点号
+ * @param fi 可忽略
+ */
+static void newfs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode;
+	boolean is_dirty = FALSE;
+	int ret = NEWFS_ERROR_NONE;
+	(void)fi;
+
+	NEWFS_TREE_RDLOCK();
+	inode = newfs_ll_inode(ino);
+	if (inode != NULL)
+	{
+		NEWFS_INODE_RDLOCK(inode);
+		is_dirty = inode->is_dirty;
+		NEWFS_INODE_UNLOCK(inode);
+	}
+	NEWFS_TREE_UNLOCK();
+
+	if (is_dirty)
+	{
+		NEWFS_TREE_WRLOCK();
+		if (inode->is_dirty)
+		{
+			ret = newfs_sync_inode(inode);
+		}
+		NEWFS_TREE_UNLOCK();
+	}
+	fuse_reply_err(req, -ret);
+}
+
+/**
+ * @brief 最后一次关闭文件时调用，释放newfs_ll_open分配的状态
+ *
+ * @param req
+ * @param ino 节点号
+ * @param fi 文件信息
+ */
+static void newfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	struct newfs_file *file = (struct newfs_file *)(uintptr_t)fi->fh;
+	(void)ino;
+
+	pthread_mutex_destroy(&file->ra_lock);
+	free(file);
+	fi->fh = 0;
+	fuse_reply_err(req, 0);
+}
+
+/**
+ * @brief 同步文件，回写所有脏inode及位图
+ *
+ * @param req
+ * @param ino 可忽略
+ * @param datasync 不作区分
+ * @param fi 可忽略
+ */
+static void newfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+	int ret;
+	(void)ino;
+	(void)datasync;
+	(void)fi;
+
+	NEWFS_TREE_WRLOCK();
+	ret = newfs_sync_fs();
+	NEWFS_TREE_UNLOCK();
+	fuse_reply_err(req, -ret);
+}
+
+/**
+ * @brief 文件系统统计，取自空闲计数
+ *
+ * @param req
+ * @param ino 可忽略
+ */
+static void newfs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	struct statvfs st;
+	(void)ino;
+
+	newfs_fill_statfs(&st);
+	fuse_reply_statfs(req, &st);
+}
+
+/**
+ * @brief 遍历目录项，off为下一次从第几个目录项开始；子inode一并载入以填充d_ino与类型
+ *
+ * @param req
+ * @param ino 目录节点号
+ * @param size 回复缓冲区大小
+ * @param off 第几个目录项
+ * @param fi 可忽略
+ */
+static void newfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+							 struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode;
+	struct newfs_dentry *sub_dentry;
+	struct stat sub_stat;
+	char *buf;
+	size_t used = 0, ent;
+	(void)fi;
+
+	NEWFS_TREE_RDLOCK();
+	inode = newfs_ll_inode(ino);
+	if (inode == NULL || !NEWFS_IS_DIR(inode))
+	{
+		NEWFS_TREE_UNLOCK();
+		fuse_reply_err(req, inode == NULL ? NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_NOTDIR);
+		return;
+	}
+	NEWFS_INODE_RDLOCK(inode);
+	if (!newfs_dir_is_loaded(inode))
+	{ /* 要补读目录项和子inode，换成写锁 */
+		NEWFS_INODE_UNLOCK(inode);
+		NEWFS_INODE_WRLOCK(inode);
+		if (newfs_read_dir_inodes(inode) != NEWFS_ERROR_NONE)
+		{
+			NEWFS_INODE_UNLOCK(inode);
+			NEWFS_TREE_UNLOCK();
+			fuse_reply_err(req, NEWFS_ERROR_IO);
+			return;
+		}
+	}
+
+	buf = (char *)malloc(size);
+	while ((sub_dentry = newfs_get_dentry(inode, off)) != NULL)
+	{
+		newfs_fill_stat(sub_dentry, &sub_stat);
+		sub_stat.st_ino = NEWFS_LL_INO(sub_dentry->ino);
+		ent = fuse_add_direntry(req, buf + used, size - used, sub_dentry->fname, &sub_stat, ++off);
+		if (ent > size - used)
+		{
+			break; /* buf已满，内核会带着off再次调用 */
+		}
+		used += ent;
+	}
+	NEWFS_INODE_UNLOCK(inode);
+	NEWFS_TREE_UNLOCK();
+
+	fuse_reply_buf(req, buf, used);
+	free(buf);
+}
+
+static struct fuse_lowlevel_ops newfs_ll_ops = {
+	.init = newfs_ll_init,		 /* mount文件系统 */
+	.destroy = newfs_ll_destroy, /* umount文件系统 */
+	.lookup = newfs_ll_lookup,	 /* 按父节点号与名字查找，内核缓存路径 */
+	.forget = newfs_ll_forget,	 /* 内核释放节点号的引用 */
+	.getattr = newfs_ll_getattr,
+	.setattr = newfs_ll_setattr, /* touch改时间 */
+	.mknod = newfs_ll_mknod,
+	.mkdir = newfs_ll_mkdir,
+	.open = newfs_ll_open,
+	.read = newfs_ll_read,
+	.write = newfs_ll_write,
+	.write_buf = newfs_ll_write_buf, /* 优先于write，数据可经splice送达 */
+	.flush = newfs_ll_flush,
+	.release = newfs_ll_release,
+	.fsync = newfs_ll_fsync,
+	.statfs = newfs_ll_statfs,
+	.readdir = newfs_ll_readdir};
+/******************************************************************************
+ * SECTION: FUSE入口
+ *******************************************************************************/
+int main(int argc, char **argv)
+{
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	struct fuse_chan *ch;
+	char *mountpoint = NULL;
+	int multithreaded, foreground;
+	int ret = -1;
+
+	newfs_options.device = strdup("/home/students/200111113/ddriver");
+	newfs_options.cache_kb = NEWFS_CACHE_KB;
+	newfs_ll_timeout = atof(NEWFS_ATTR_TIMEOUT);
+
+	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1 ||
+		fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1)
+		return -1;
+	/* 一次请求最多NEWFS_MAX_XFER，已能容纳整个文件，cp一个文件只需一次回调 */
+	fuse_opt_add_arg(&args, "-obig_writes,max_write=" NEWFS_MAX_XFER ",max_read=" NEWFS_MAX_XFER);
+
+	ch = fuse_mount(mountpoint, &args);
+	if (ch != NULL)
+	{
+		newfs_ll_session = fuse_lowlevel_new(&args, &newfs_ll_ops, sizeof(newfs_ll_ops), NULL);
+		if (newfs_ll_session != NULL && fuse_set_signal_handlers(newfs_ll_session) != -1)
+		{
+			fuse_session_add_chan(newfs_ll_session, ch);
+			fuse_daemonize(foreground);
+			/* 与路径接口一样默认多线程分发，-s时单线程 */
+			ret = multithreaded ? fuse_session_loop_mt(newfs_ll_session) : fuse_session_loop(newfs_ll_session);
+			fuse_remove_signal_handlers(newfs_ll_session);
+			fuse_session_remove_chan(ch);
+		}
+		if (newfs_ll_session != NULL)
+		{
+			fuse_session_destroy(newfs_ll_session);
+		}
+		fuse_unmount(mountpoint, ch);
+	}
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+	return ret ? 1 : 0;
+}
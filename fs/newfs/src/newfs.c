@@ -13,10 +13,11 @@
  *******************************************************************************/
 static const struct fuse_opt option_spec[] = {/* 用于FUSE文件系统解析参数 */
 											  OPTION("--device=%s", device),
+											  OPTION("--cache_kb=%d", cache_kb),
 											  FUSE_OPT_END};
 
 struct custom_options newfs_options; /* 全局选项 */
-struct newfs_super newfs_super;
+extern struct newfs_super newfs_super;
 /******************************************************************************
  * SECTION: FUSE操作定义
  *******************************************************************************/
@@ -27,15 +28,20 @@ static struct fuse_operations operations = {
 	.getattr = newfs_getattr, /* 获取文件属性，类似stat，必须完成 */
 	.readdir = newfs_readdir, /* 填充dentrys */
 	.mknod = newfs_mknod,	  /* 创建文件，touch相关 */
-	.write = NULL,			  /* 写入文件 */
-	.read = NULL,			  /* 读文件 */
-	.utimens = newfs_utimens, /* 修改时间，忽略，避免touch报错 */
+	.write = newfs_write,	  /* 写入文件 */
+	.read = newfs_read,		  /* 读文件 */
+	.write_buf = newfs_write_buf, /* 写入文件，splice来的数据直接拷入页缓存 */
+	.utimens = newfs_utimens, /* 修改时间，touch */
 	.truncate = NULL,		  /* 改变文件大小 */
 	.unlink = NULL,			  /* 删除文件 */
 	.rmdir = NULL,			  /* 删除目录， rm -r */
 	.rename = NULL,			  /* 重命名，mv */
+	.fsync = newfs_fsync,	  /* 回写脏数据 */
+	.flush = newfs_flush,	  /* close时回写该文件 */
+	.statfs = newfs_statfs,	  /* df，取自空闲计数 */
 
-	.open = NULL,
+	.open = newfs_open,		  /* 分配打开文件的预读状态 */
+	.release = newfs_release, /* 释放打开文件的预读状态 */
 	.opendir = NULL,
 	.access = NULL};
 /******************************************************************************
@@ -44,7 +50,7 @@ static struct fuse_operations operations = {
 /**
  * @brief 挂载（mount）文件系统
  *
- * @param conn_info 可忽略，一些建立连接相关的信息
+ * @param conn_info 内核能力协商
  * @return void*
  */
 void *newfs_init(struct fuse_conn_info *conn_info)
@@ -55,6 +61,24 @@ void *newfs_init(struct fuse_conn_info *conn_info)
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	}
+	if (conn_info->capable & FUSE_CAP_BIG_WRITES)
+	{ /* 写请求不再按4KiB拆分，最多NEWFS_MAX_XFER一次 */
+		conn_info->want |= FUSE_CAP_BIG_WRITES;
+	}
+	if (conn_info->capable & FUSE_CAP_SPLICE_READ)
+	{ /* 写入的数据留在管道里，由newfs_write_buf直接读进页缓存 */
+		conn_info->want |= FUSE_CAP_SPLICE_READ;
+	}
+#ifdef FUSE_CAP_WRITEBACK_CACHE
+	if (conn_info->capable & FUSE_CAP_WRITEBACK_CACHE)
+	{ /* 小写先在内核页缓存中合并，回写时才成批下发 */
+		conn_info->want |= FUSE_CAP_WRITEBACK_CACHE;
+	}
+#endif
+	if (newfs_start_writeback() != NEWFS_ERROR_NONE)
+	{
+		NEWFS_DBG("[%s] writeback thread error\n", __func__);
+	}
 	return NULL;
 }
 
@@ -66,6 +90,7 @@ void *newfs_init(struct fuse_conn_info *conn_info)
  */
 void newfs_destroy(void *p)
 {
+	newfs_stop_writeback();
 	if (newfs_umount() != NEWFS_ERROR_NONE)
 	{
 		NEWFS_DBG("[%s] unmount error\n", __func__);
@@ -87,27 +112,28 @@ int newfs_mkdir(const char *path, mode_t mode)
 	(void)mode;
 	boolean is_find, is_root;
 	char *fname;
-	struct newfs_dentry *last_dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry *dentry;
-	struct newfs_inode *inode;
+	struct newfs_dentry *last_dentry;
+	int ret;
 
+	NEWFS_TREE_RDLOCK();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find)
 	{
+		NEWFS_TREE_UNLOCK();
 		return -NEWFS_ERROR_EXISTS;
 	}
 
 	if (NEWFS_IS_REG(last_dentry->inode))
 	{
+		NEWFS_TREE_UNLOCK();
 		return -NEWFS_ERROR_UNSUPPORTED;
 	}
 
 	fname = newfs_get_fname(path);
-	dentry = new_dentry(fname, NEWFS_DIR);
-	dentry->parent = last_dentry;
-	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	ret = newfs_dir_create(last_dentry, fname, NEWFS_DIR, NULL);
 
-	return NEWFS_ERROR_NONE;
+	NEWFS_TREE_UNLOCK();
+	return ret;
 }
 
 /**
@@ -120,41 +146,20 @@ int newfs_mkdir(const char *path, mode_t mode)
 int newfs_getattr(const char *path, struct stat *newfs_stat)
 {
 	boolean is_find, is_root;
-	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dentry *dentry;
+
+	NEWFS_TREE_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find == FALSE)
 	{
+		NEWFS_TREE_UNLOCK();
 		return -NEWFS_ERROR_NOTFOUND;
 	}
 
-	if (NEWFS_IS_DIR(dentry->inode))
-	{
-		newfs_stat->st_mode = S_IFDIR | NEWFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);
-	}
-	else if (NEWFS_IS_REG(dentry->inode))
-	{
-		newfs_stat->st_mode = S_IFREG | NEWFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->size;
-	}
-	else if (NEWFS_IS_SYM_LINK(dentry->inode))
-	{
-		newfs_stat->st_mode = S_IFLNK | NEWFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->size;
-	}
-
-	newfs_stat->st_nlink = 1;
-	newfs_stat->st_uid = getuid();
-	newfs_stat->st_gid = getgid();
-	newfs_stat->st_atime = time(NULL);
-	newfs_stat->st_mtime = time(NULL);
-	newfs_stat->st_blksize = NEWFS_BLOCK_SZ();
-
-	if (is_root)
-	{
-		newfs_stat->st_size = newfs_super.sz_usage;
-		newfs_stat->st_blocks = NEWFS_DISK_SZ() / NEWFS_BLOCK_SZ();
-		newfs_stat->st_nlink = 2; /* !特殊，根目录link数为2 */
-	}
+	NEWFS_INODE_RDLOCK(dentry->inode);
+	newfs_fill_stat(dentry, newfs_stat);
+	NEWFS_INODE_UNLOCK(dentry->inode);
+	NEWFS_TREE_UNLOCK();
 	return NEWFS_ERROR_NONE;
 }
 
@@ -169,7 +174,7 @@ int newfs_getattr(const char *path, struct stat *newfs_stat)
  *				const struct stat *stbuf, off_t off)
  * buf: name会被复制到buf中
  * name: dentry名字
- * stbuf: 文件状态，可忽略
+ * stbuf: 文件状态，这里一并填充，子inode也随之载入，后续getattr直接命中缓存
  * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
  *
  * @param offset 第几个目录项？
@@ -179,23 +184,44 @@ int newfs_getattr(const char *path, struct stat *newfs_stat)
 int newfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
 				  struct fuse_file_info *fi)
 {
-	/* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/newfs.c的newfs_readdir()函数实现 */
 	boolean is_find, is_root;
 	int cur_dir = offset;
 
-	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dentry *dentry;
 	struct newfs_dentry *sub_dentry;
 	struct newfs_inode *inode;
+	struct stat sub_stat;
+
+	NEWFS_TREE_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find)
 	{
 		inode = dentry->inode;
-		sub_dentry = newfs_get_dentry(inode, cur_dir);
-		if (sub_dentry)
+		NEWFS_INODE_RDLOCK(inode);
+		if (!newfs_dir_is_loaded(inode))
+		{ /* 要补读目录项和子inode，换成写锁 */
+			NEWFS_INODE_UNLOCK(inode);
+			NEWFS_INODE_WRLOCK(inode);
+			if (newfs_read_dir_inodes(inode) != NEWFS_ERROR_NONE)
+			{
+				NEWFS_INODE_UNLOCK(inode);
+				NEWFS_TREE_UNLOCK();
+				return -NEWFS_ERROR_IO;
+			}
+		}
+		while ((sub_dentry = newfs_get_dentry(inode, cur_dir++)) != NULL)
 		{
-			filler(buf, sub_dentry->fname, NULL, ++offset);
+			newfs_fill_stat(sub_dentry, &sub_stat);
+			if (filler(buf, sub_dentry->fname, &sub_stat, ++offset) != 0)
+			{
+				break; /* buf已满，FUSE会带着offset再次调用 */
+			}
 		}
+		NEWFS_INODE_UNLOCK(inode);
+		NEWFS_TREE_UNLOCK();
 		return NEWFS_ERROR_NONE;
 	}
+	NEWFS_TREE_UNLOCK();
 	return -NEWFS_ERROR_NOTFOUND;
 }
 
@@ -211,49 +237,51 @@ int newfs_mknod(const char *path, mode_t mode, dev_t dev)
 {
 	boolean is_find, is_root;
 
-	struct newfs_dentry *last_dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry *dentry;
-	struct newfs_inode *inode;
+	struct newfs_dentry *last_dentry;
 	char *fname;
+	int ret;
 
+	NEWFS_TREE_RDLOCK();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find == TRUE)
 	{
+		NEWFS_TREE_UNLOCK();
 		return -NEWFS_ERROR_EXISTS;
 	}
 
 	fname = newfs_get_fname(path);
 	printf("in newfs fname:%s\n", fname);
 
-	if (S_ISREG(mode))
-	{
-		dentry = new_dentry(fname, NEWFS_REG_FILE);
-	}
-	else if (S_ISDIR(mode))
-	{
-		dentry = new_dentry(fname, NEWFS_DIR);
-	}
-	else
-	{
-		dentry = new_dentry(fname, NEWFS_REG_FILE);
-	}
-	dentry->parent = last_dentry;
-	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	ret = newfs_dir_create(last_dentry, fname, S_ISDIR(mode) ? NEWFS_DIR : NEWFS_REG_FILE, NULL);
 
-	return NEWFS_ERROR_NONE;
+	NEWFS_TREE_UNLOCK();
+	return ret;
 }
 
 /**
- * @brief 修改时间，为了不让touch报错
+ * @brief 修改时间，随inode一起落盘
  *
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv 访问时间与修改时间，UTIME_NOW已由libfuse换成当前时间
  * @return int 0成功，否则失败
  */
 int newfs_utimens(const char *path, const struct timespec tv[2])
 {
-	(void)path;
-	return 0;
+	boolean is_find, is_root;
+	struct newfs_dentry *dentry;
+
+	NEWFS_TREE_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (!is_find)
+	{
+		NEWFS_TREE_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	NEWFS_INODE_WRLOCK(dentry->inode);
+	newfs_set_times(dentry->inode, tv[0].tv_sec, tv[1].tv_sec);
+	NEWFS_INODE_UNLOCK(dentry->inode);
+	NEWFS_TREE_UNLOCK();
+	return NEWFS_ERROR_NONE;
 }
 /******************************************************************************
  * SECTION: 选做函数实现
@@ -271,8 +299,64 @@ int newfs_utimens(const char *path, const struct timespec tv[2])
 int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 				struct fuse_file_info *fi)
 {
-	/* 选做 */
-	return size;
+	boolean is_find, is_root;
+	struct newfs_dentry *dentry;
+	int ret;
+
+	NEWFS_TREE_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (!is_find)
+	{
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(dentry->inode))
+	{
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else
+	{
+		NEWFS_INODE_WRLOCK(dentry->inode);
+		ret = newfs_write_data(dentry->inode, buf, size, offset);
+		NEWFS_INODE_UNLOCK(dentry->inode);
+	}
+	NEWFS_TREE_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 写入文件，内核启用splice时buf指向管道，数据不经中间缓冲
+ *
+ * @param path 相对于挂载点的路径
+ * @param buf 写入的内容
+ * @param offset 相对文件的偏移
+ * @param fi 可忽略
+ * @return int 写入大小
+ */
+int newfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+					struct fuse_file_info *fi)
+{
+	boolean is_find, is_root;
+	struct newfs_dentry *dentry;
+	int ret;
+
+	NEWFS_TREE_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (!is_find)
+	{
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(dentry->inode))
+	{
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else
+	{
+		NEWFS_INODE_WRLOCK(dentry->inode);
+		ret = newfs_write_bufvec(dentry->inode, buf, offset);
+		NEWFS_INODE_UNLOCK(dentry->inode);
+	}
+	NEWFS_TREE_UNLOCK();
+	return ret;
 }
 
 /**
@@ -288,8 +372,41 @@ int newfs_write(const char *path, const char *buf, size_t size, off_t offset,
 int newfs_read(const char *path, char *buf, size_t size, off_t offset,
 			   struct fuse_file_info *fi)
 {
-	/* 选做 */
-	return size;
+	boolean is_find, is_root;
+	struct newfs_dentry *dentry;
+	struct newfs_inode *inode;
+	struct newfs_file *file = fi ? (struct newfs_file *)(uintptr_t)fi->fh : NULL;
+	int ret;
+
+	NEWFS_TREE_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (!is_find)
+	{
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(dentry->inode))
+	{
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else
+	{
+		inode = dentry->inode;
+		NEWFS_INODE_RDLOCK(inode);
+		if (!newfs_is_cached(inode, offset, size))
+		{ /* 要读盘填充页缓存，换成写锁，预读也只在此时进行 */
+			NEWFS_INODE_UNLOCK(inode);
+			NEWFS_INODE_WRLOCK(inode);
+			newfs_readahead(inode, file, offset, size);
+		}
+		else if (file)
+		{ /* 命中缓存时只记录读到的位置，顺序读在下次未命中时照常扩大窗口 */
+			newfs_ra_update(file, offset, size, FALSE);
+		}
+		ret = newfs_read_data(inode, buf, size, offset);
+		NEWFS_INODE_UNLOCK(inode);
+	}
+	NEWFS_TREE_UNLOCK();
+	return ret;
 }
 
 /**
@@ -336,8 +453,75 @@ int newfs_rename(const char *from, const char *to)
 }
 
 /**
- * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
- * 保存在fh中
+ * @brief 同步文件，回写所有脏inode及位图，保证新建文件所在目录一并落盘
+ *
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时只需同步数据，这里不作区分
+ * @param fi 可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	int ret;
+	(void)path;
+	(void)datasync;
+
+	NEWFS_TREE_WRLOCK();
+	ret = newfs_sync_fs();
+	NEWFS_TREE_UNLOCK();
+	return ret;
+}
+
+/**
+ * @brief 关闭文件时调用，只回写该文件本身的inode，其余修改交给后台回写
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 可忽略
+ * @return int 0成功，否则失败
+ */
+int newfs_flush(const char *path, struct fuse_file_info *fi)
+{
+	struct newfs_inode *inode = ((struct newfs_file *)(uintptr_t)fi->fh)->inode;
+	boolean is_dirty;
+	int ret = NEWFS_ERROR_NONE;
+	(void)path;
+
+	/* open时已钉住inode，两次加锁之间它不会被淘汰 */
+	NEWFS_TREE_RDLOCK();
+	NEWFS_INODE_RDLOCK(inode);
+	is_dirty = inode->is_dirty;
+	NEWFS_INODE_UNLOCK(inode);
+	NEWFS_TREE_UNLOCK();
+
+	if (is_dirty)
+	{ /* 回写要独占；之前未脏的文件不必等其他操作退出 */
+		NEWFS_TREE_WRLOCK();
+		if (inode->is_dirty)
+		{
+			ret = newfs_sync_inode(inode);
+		}
+		NEWFS_TREE_UNLOCK();
+	}
+	return ret;
+}
+
+/**
+ * @brief 文件系统统计，供df使用；空闲inode与块数随分配释放维护，不扫描位图
+ *
+ * @param path 可忽略
+ * @param st 返回统计
+ * @return int 0成功
+ */
+int newfs_statfs(const char *path, struct statvfs *st)
+{
+	(void)path;
+
+	newfs_fill_statfs(st);
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 打开文件，钉住其inode，在fi->fh中保存该次打开的顺序读检测与预读窗口
  *
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
@@ -345,7 +529,45 @@ int newfs_rename(const char *from, const char *to)
  */
 int newfs_open(const char *path, struct fuse_file_info *fi)
 {
-	/* 选做 */
+	boolean is_find, is_root;
+	struct newfs_dentry *dentry;
+	struct newfs_file *file;
+
+	NEWFS_TREE_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (!is_find)
+	{
+		NEWFS_TREE_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	newfs_inode_get(dentry->inode); /* 打开期间不被淘汰，缓存的数据块也一直保留 */
+	NEWFS_TREE_UNLOCK();
+
+	file = (struct newfs_file *)malloc(sizeof(struct newfs_file));
+	file->inode = dentry->inode;
+	file->next_offset = 0; /* 从头读视为顺序读 */
+	file->ra_window = NEWFS_RA_INIT / 2; /* 首次顺序读翻倍后即为NEWFS_RA_INIT */
+	pthread_mutex_init(&file->ra_lock, NULL);
+	fi->fh = (uint64_t)(uintptr_t)file;
+	return 0;
+}
+
+/**
+ * @brief 最后一次关闭文件时调用，释放newfs_open分配的状态
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功
+ */
+int newfs_release(const char *path, struct fuse_file_info *fi)
+{
+	struct newfs_file *file = (struct newfs_file *)(uintptr_t)fi->fh;
+	(void)path;
+
+	newfs_inode_put(file->inode);
+	pthread_mutex_destroy(&file->ra_lock);
+	free(file);
+	fi->fh = 0;
 	return 0;
 }
 
@@ -401,10 +623,19 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	newfs_options.device = strdup("/home/students/200111113/ddriver");
+	newfs_options.cache_kb = NEWFS_CACHE_KB;
 
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
 
+	/* 所有修改都经由本挂载点，内核缓存的页、属性与（不存在的）目录项不会过期：
+	 * kernel_cache使重复open保留页缓存，readdir已带回完整属性，ls -l不必逐项回调getattr */
+	fuse_opt_add_arg(&args, "-okernel_cache,attr_timeout=" NEWFS_ATTR_TIMEOUT ",entry_timeout=" NEWFS_ATTR_TIMEOUT
+							",negative_timeout=" NEWFS_ATTR_TIMEOUT);
+	/* 默认读写按4KiB一页一次回调，放大后cp一个文件只需一两次回调 */
+	fuse_opt_add_arg(&args, "-obig_writes,max_write=" NEWFS_MAX_XFER ",max_read=" NEWFS_MAX_XFER);
+
+	/* 不加-s，fuse_main使用多线程循环分发请求，各操作靠tree_lock与inode锁并发执行 */
 	ret = fuse_main(args.argc, args.argv, &operations, NULL);
 	fuse_opt_free_args(&args);
 	return ret;
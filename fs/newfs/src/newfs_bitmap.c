@@ -0,0 +1,175 @@
+#include "../include/newfs.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * 位图按字节小端编号：第i位在map[i / 8]的第(i % 8)位。
+ * 整字节的比较与计数与字节序无关，所以先用向量/64位字成段跳过，最后在单个字节内定位。
+ */
+
+/**
+ * @brief 从byte开始跳过值全为fill的字节
+ *
+ * @param map 位图
+ * @param byte 起始字节
+ * @param end 结束字节（不含）
+ * @param fill 0xFF跳过全占用，0x00跳过全空闲
+ * @return int 第一个不等于fill的字节，都相等则返回end
+ */
+static int newfs_bitmap_skip(const uint8_t *map, int byte, int end, uint8_t fill)
+{
+    uint64_t word, fill64 = fill ? ~0ULL : 0ULL;
+
+#if defined(__AVX2__)
+    const __m256i key = _mm256_set1_epi8((char)fill);
+    for (; byte + 32 <= end; byte += 32)
+    {
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(map + byte)), key)) != -1)
+        {
+            break;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i key = _mm_set1_epi8((char)fill);
+    for (; byte + 16 <= end; byte += 16)
+    {
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(map + byte)), key)) != 0xFFFF)
+        {
+            break;
+        }
+    }
+#endif
+    for (; byte + 8 <= end; byte += 8)
+    {
+        memcpy(&word, map + byte, sizeof(word));
+        if (word != fill64)
+        {
+            break;
+        }
+    }
+    while (byte < end && map[byte] == fill)
+    {
+        byte++;
+    }
+    return byte;
+}
+/**
+ * @brief 在位图的[from, cnt)位中找第一个空闲位
+ *
+ * @param map 位图
+ * @param from
+ * @param cnt
+ * @return int 空闲位下标，没有则返回-1
+ */
+int newfs_bitmap_find(const uint8_t *map, int from, int cnt)
+{
+    int end = (cnt + UINT8_BITS - 1) / UINT8_BITS;
+    int byte = from / UINT8_BITS;
+    int bit;
+    uint8_t free_bits;
+
+    if (from >= cnt)
+    {
+        return -1;
+    }
+    free_bits = (uint8_t)(~map[byte] & (0xFF << (from % UINT8_BITS)));
+    if (free_bits == 0)
+    {
+        byte = newfs_bitmap_skip(map, byte + 1, end, 0xFF);
+        if (byte == end)
+        {
+            return -1;
+        }
+        free_bits = (uint8_t)~map[byte];
+    }
+    bit = byte * UINT8_BITS + __builtin_ctz(free_bits);
+    return bit < cnt ? bit : -1;
+}
+/**
+ * @brief 位图中从bit开始的连续空闲位数
+ *
+ * @param map 位图
+ * @param bit 起始位
+ * @param cnt 位图有效位数
+ * @param max 数到max为止
+ * @return int
+ */
+int newfs_bitmap_run(const uint8_t *map, int bit, int cnt, int max)
+{
+    int limit = cnt - bit < max ? cnt - bit : max;
+    int byte = bit / UINT8_BITS;
+    int end, next, len;
+    uint8_t used;
+
+    if (limit <= 0)
+    {
+        return 0;
+    }
+    used = map[byte] >> (bit % UINT8_BITS);
+    if (used)
+    {
+        len = __builtin_ctz(used);
+        return len < limit ? len : limit;
+    }
+    len = UINT8_BITS - bit % UINT8_BITS;
+    end = (bit + limit + UINT8_BITS - 1) / UINT8_BITS;
+    if (len < limit)
+    {
+        next = newfs_bitmap_skip(map, byte + 1, end, 0x00);
+        len += (next - byte - 1) * UINT8_BITS;
+        if (next < end)
+        {
+            len += __builtin_ctz(map[next]);
+        }
+    }
+    return len < limit ? len : limit;
+}
+/**
+ * @brief 位图前cnt位中已占用的位数
+ *
+ * @param map 位图
+ * @param cnt
+ * @return int
+ */
+int newfs_bitmap_count(const uint8_t *map, int cnt)
+{
+    int bytes = cnt / UINT8_BITS;
+    int byte = 0, used = 0;
+    uint64_t word;
+
+#if defined(__AVX2__)
+    /* 每个字节拆成两个4位查表求和，再按64位横向累加 */
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i acc = _mm256_setzero_si256();
+    __m256i v, sum;
+
+    for (; byte + 32 <= bytes; byte += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)(map + byte));
+        sum = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                              _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(sum, _mm256_setzero_si256()));
+    }
+    used += _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+            _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+#endif
+    for (; byte + 8 <= bytes; byte += 8)
+    {
+        memcpy(&word, map + byte, sizeof(word));
+        used += __builtin_popcountll(word);
+    }
+    for (; byte < bytes; byte++)
+    {
+        used += __builtin_popcount(map[byte]);
+    }
+    if (cnt % UINT8_BITS)
+    {
+        used += __builtin_popcount(map[bytes] & ((0x1 << (cnt % UINT8_BITS)) - 1));
+    }
+    return used;
+}
@@ -7,6 +7,20 @@ void newfs_dump_map()
 {
     int byte_cursor = 0;
     int bit_cursor = 0;
+    int group, ino_used = 0, data_used = 0;
+
+    for (group = 0; group < newfs_super.groups_cnt; group++)
+    {
+        ino_used += newfs_bitmap_count(newfs_super.map_inode + NEWFS_BLKS_SZ(group),
+                                       newfs_super.max_ino - group * newfs_super.inodes_per_group < newfs_super.inodes_per_group
+                                           ? newfs_super.max_ino - group * newfs_super.inodes_per_group
+                                           : newfs_super.inodes_per_group);
+        data_used += newfs_bitmap_count(newfs_super.map_data + NEWFS_BLKS_SZ(group),
+                                        newfs_super.max_data - group * newfs_super.data_per_group < newfs_super.data_per_group
+                                            ? newfs_super.max_data - group * newfs_super.data_per_group
+                                            : newfs_super.data_per_group);
+    }
+    printf("inode used %d/%d, data used %d/%d\n", ino_used, newfs_super.max_ino, data_used, newfs_super.max_data);
 
     // for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_inode_blks);
     //      byte_cursor += 4)
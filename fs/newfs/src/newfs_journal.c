@@ -0,0 +1,641 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super newfs_super;
+
+#define NEWFS_JOURNAL_CHECKSUM_INIT 2166136261u
+
+/*
+ * 元数据预写日志
+ *
+ * inode表、目录块、索引块、超级块与位图的写入经newfs_journal_write先落在内存缓存中，
+ * 一次newfs_sync_fs内的全部修改在newfs_journal_commit时作为一个事务顺序写入日志区：
+ * | 描述块 | 数据块 ... | 描述块 | 数据块 ... | 提交块 |
+ * 文件数据仍直接写回原位，且先于提交完成（ordered）。提交后的块留在缓存里覆盖读路径，
+ * 直到日志区将满或卸载时才由newfs_journal_checkpoint按块号顺序写回原位。
+ * 挂载时newfs_journal_load从head开始回放序号连续、校验和正确的事务。
+ */
+
+/**
+ * @brief FNV-1a校验和，可分段累加
+ *
+ * @param sum 上一段的结果，首段传NEWFS_JOURNAL_CHECKSUM_INIT
+ * @param buf
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t newfs_journal_checksum(uint32_t sum, const uint8_t *buf, int len)
+{
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        sum = (sum ^ buf[i]) * 16777619u;
+    }
+    return sum;
+}
+/**
+ * @brief 日志记录区可循环使用的块数
+ *
+ * @return int
+ */
+static int newfs_journal_cap()
+{
+    return newfs_super.journal.blks - 1;
+}
+/**
+ * @brief 写日志超级块，记录当前的head与其序号
+ *
+ * @return int
+ */
+static int newfs_journal_write_super()
+{
+    struct newfs_journal_super_d journal_super_d;
+
+    memset(&journal_super_d, 0, sizeof(struct newfs_journal_super_d));
+    journal_super_d.magic = NEWFS_JOURNAL_MAGIC;
+    journal_super_d.seq = newfs_super.journal.head_seq;
+    journal_super_d.head = newfs_super.journal.head;
+    return newfs_driver_write(newfs_super.journal.offset, (uint8_t *)&journal_super_d,
+                              sizeof(struct newfs_journal_super_d));
+}
+/**
+ * @brief 初始化空日志，由newfs_format在填好newfs_super_d.journal_*后调用
+ *
+ * 序号从随机值开始，避免把旧文件系统残留在日志区里的记录当作有效事务回放
+ *
+ * @return int
+ */
+int newfs_journal_format()
+{
+    newfs_super.journal.head = 0;
+    newfs_super.journal.tail = 0;
+    newfs_super.journal.head_seq = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    newfs_super.journal.seq = newfs_super.journal.head_seq;
+    return newfs_journal_write_super();
+}
+/**
+ * @brief 在缓存中查找块
+ *
+ * @param blk 绝对块号
+ * @return struct newfs_jblock*
+ */
+static struct newfs_jblock *newfs_journal_find(int blk)
+{
+    struct newfs_jblock *jblock = newfs_super.journal.buckets[blk % NEWFS_JOURNAL_HASH];
+    while (jblock && jblock->blk != blk)
+    {
+        jblock = jblock->next;
+    }
+    return jblock;
+}
+/**
+ * @brief 从缓存中摘除并释放一个块
+ *
+ * @param blk 绝对块号
+ */
+static void newfs_journal_forget(int blk)
+{
+    struct newfs_jblock **link = &newfs_super.journal.buckets[blk % NEWFS_JOURNAL_HASH];
+    struct newfs_jblock *jblock;
+
+    while (*link && (*link)->blk != blk)
+    {
+        link = &(*link)->next;
+    }
+    if (*link == NULL)
+    {
+        return;
+    }
+    jblock = *link;
+    *link = jblock->next;
+    if (jblock->in_txn)
+    {
+        newfs_super.journal.txn_cnt--;
+    }
+    newfs_super.journal.cached_cnt--;
+    free(jblock->ckpt);
+    free(jblock->data);
+    free(jblock);
+}
+/**
+ * @brief 用缓存中较新的元数据覆盖刚从磁盘读出的内容，由newfs_driver_read调用
+ *
+ * @param offset 块对齐的偏移
+ * @param content
+ * @param size 块对齐的长度
+ */
+void newfs_journal_overlay(int offset, uint8_t *content, int size)
+{
+    struct newfs_jblock *jblock;
+    int blk;
+
+    if (newfs_super.journal.cached_cnt == 0)
+    {
+        return;
+    }
+    for (blk = offset / NEWFS_BLOCK_SZ(); NEWFS_BLKS_SZ(blk) < offset + size; blk++)
+    {
+        jblock = newfs_journal_find(blk);
+        if (jblock)
+        {
+            memcpy(content + NEWFS_BLKS_SZ(blk) - offset, jblock->data, NEWFS_BLOCK_SZ());
+        }
+    }
+}
+/**
+ * @brief 元数据写：修改进入当前事务，等待newfs_journal_commit；日志未启用时直接写盘
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_journal_write(int offset, uint8_t *in_content, int size)
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_jblock *jblock;
+    int end = offset + size;
+    int blk, blk_ofs, from, to;
+
+    if (!journal->is_enabled)
+    {
+        return newfs_driver_write(offset, in_content, size);
+    }
+    for (blk = offset / NEWFS_BLOCK_SZ(); NEWFS_BLKS_SZ(blk) < end; blk++)
+    {
+        jblock = newfs_journal_find(blk);
+        if (jblock == NULL)
+        {
+            jblock = (struct newfs_jblock *)calloc(1, sizeof(struct newfs_jblock));
+            jblock->blk = blk;
+            jblock->data = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+            if (newfs_driver_read(NEWFS_BLKS_SZ(blk), jblock->data, NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+            {
+                free(jblock->data);
+                free(jblock);
+                return -NEWFS_ERROR_IO;
+            }
+            jblock->next = journal->buckets[blk % NEWFS_JOURNAL_HASH];
+            journal->buckets[blk % NEWFS_JOURNAL_HASH] = jblock;
+            journal->cached_cnt++;
+        }
+        if (!jblock->in_txn)
+        {
+            /* 已提交未检查点的内容要留给检查点，不能被未提交的修改覆盖 */
+            if (jblock->is_committed)
+            {
+                jblock->ckpt = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+                memcpy(jblock->ckpt, jblock->data, NEWFS_BLOCK_SZ());
+            }
+            jblock->in_txn = TRUE;
+            journal->txn_cnt++;
+        }
+        blk_ofs = NEWFS_BLKS_SZ(blk);
+        from = offset > blk_ofs ? offset : blk_ofs;
+        to = end < blk_ofs + NEWFS_BLOCK_SZ() ? end : blk_ofs + NEWFS_BLOCK_SZ();
+        memcpy(jblock->data + from - blk_ofs, in_content + from - offset, to - from);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 记录一个释放的数据块。日志中可能还有该块作为元数据时的旧内容，
+ * 回放会覆盖复用后写入的文件数据，因此要等检查点之后才真正归还位图
+ *
+ * @param bno
+ */
+void newfs_journal_defer_free(int bno)
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+
+    if (journal->pending_cnt == journal->pending_max)
+    {
+        journal->pending_max = journal->pending_max ? journal->pending_max * 2 : 64;
+        journal->pending_free = (int *)realloc(journal->pending_free, journal->pending_max * sizeof(int));
+    }
+    journal->pending_free[journal->pending_cnt++] = bno;
+}
+static int newfs_cmp_jblock(const void *a, const void *b)
+{
+    return (*(struct newfs_jblock **)a)->blk - (*(struct newfs_jblock **)b)->blk;
+}
+/**
+ * @brief 按块号收集满足条件的缓存块
+ *
+ * @param in_txn TRUE收集当前事务中的块，FALSE收集已提交待检查点的块
+ * @param cnt 输出个数
+ * @return struct newfs_jblock** 需由调用者释放
+ */
+static struct newfs_jblock **newfs_journal_collect(boolean in_txn, int *cnt)
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_jblock **jblocks;
+    struct newfs_jblock *jblock;
+    int bucket;
+
+    jblocks = (struct newfs_jblock **)malloc((journal->cached_cnt + 1) * sizeof(struct newfs_jblock *));
+    *cnt = 0;
+    for (bucket = 0; bucket < NEWFS_JOURNAL_HASH; bucket++)
+    {
+        for (jblock = journal->buckets[bucket]; jblock; jblock = jblock->next)
+        {
+            if (in_txn ? jblock->in_txn : jblock->is_committed)
+            {
+                jblocks[(*cnt)++] = jblock;
+            }
+        }
+    }
+    qsort(jblocks, *cnt, sizeof(struct newfs_jblock *), newfs_cmp_jblock);
+    return jblocks;
+}
+/**
+ * @brief 把一组按块号排序的块写回原位，相邻块合并为一次写
+ *
+ * @param jblocks
+ * @param cnt
+ * @param in_txn TRUE时写最新内容，否则写已提交的内容
+ * @return int
+ */
+static int newfs_journal_write_home(struct newfs_jblock **jblocks, int cnt, boolean in_txn)
+{
+    uint8_t *run;
+    int i, j, k, ret = NEWFS_ERROR_NONE;
+
+    for (i = 0; i < cnt && ret == NEWFS_ERROR_NONE; i = j)
+    {
+        for (j = i + 1; j < cnt && jblocks[j]->blk == jblocks[j - 1]->blk + 1; j++)
+            ;
+        run = (uint8_t *)malloc(NEWFS_BLKS_SZ((j - i)));
+        for (k = i; k < j; k++)
+        {
+            memcpy(run + NEWFS_BLKS_SZ((k - i)),
+                   (!in_txn && jblocks[k]->ckpt) ? jblocks[k]->ckpt : jblocks[k]->data, NEWFS_BLOCK_SZ());
+        }
+        ret = newfs_driver_write(NEWFS_BLKS_SZ(jblocks[i]->blk), run, NEWFS_BLKS_SZ((j - i)));
+        free(run);
+    }
+    return ret;
+}
+/**
+ * @brief 检查点：把已提交的块写回原位，清空日志，归还提交前释放的数据块
+ *
+ * 当前事务中尚未提交的修改保留在缓存中，不受影响
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint()
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_jblock **jblocks;
+    int cnt, i, ret;
+
+    if (!journal->is_enabled)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    jblocks = newfs_journal_collect(FALSE, &cnt);
+    ret = newfs_journal_write_home(jblocks, cnt, FALSE);
+    if (ret != NEWFS_ERROR_NONE)
+    {
+        free(jblocks);
+        return -NEWFS_ERROR_IO;
+    }
+    journal->head = journal->tail;
+    journal->head_seq = journal->seq;
+    if (newfs_journal_write_super() != NEWFS_ERROR_NONE)
+    {
+        free(jblocks);
+        return -NEWFS_ERROR_IO;
+    }
+
+    for (i = 0; i < cnt; i++)
+    {
+        jblocks[i]->is_committed = FALSE;
+        free(jblocks[i]->ckpt);
+        jblocks[i]->ckpt = NULL;
+        if (!jblocks[i]->in_txn)
+        {
+            newfs_journal_forget(jblocks[i]->blk);
+        }
+    }
+    free(jblocks);
+
+    /* 旧内容已不会再被回放，释放的块可以复用了；位图的变化进入下一个事务 */
+    for (i = 0; i < journal->pending_committed; i++)
+    {
+        newfs_journal_forget(NEWFS_DATA_OFS(journal->pending_free[i]) / NEWFS_BLOCK_SZ());
+        newfs_release_bno(journal->pending_free[i]);
+    }
+    memmove(journal->pending_free, journal->pending_free + journal->pending_committed,
+            (journal->pending_cnt - journal->pending_committed) * sizeof(int));
+    journal->pending_cnt -= journal->pending_committed;
+    journal->pending_committed = 0;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 向记录区写入连续的若干块，必要时绕回记录区开头
+ *
+ * @param pos 记录区内的起始位置
+ * @param buf
+ * @param cnt 块数
+ * @return int
+ */
+static int newfs_journal_put(int pos, uint8_t *buf, int cnt)
+{
+    int first = newfs_journal_cap() - pos;
+
+    if (first >= cnt)
+    {
+        return newfs_driver_write(NEWFS_JOURNAL_OFS(pos), buf, NEWFS_BLKS_SZ(cnt));
+    }
+    if (newfs_driver_write(NEWFS_JOURNAL_OFS(pos), buf, NEWFS_BLKS_SZ(first)) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    return newfs_driver_write(NEWFS_JOURNAL_OFS(0), buf + NEWFS_BLKS_SZ(first), NEWFS_BLKS_SZ((cnt - first)));
+}
+/**
+ * @brief 提交当前事务（组提交）：把本次回写积累的全部元数据块一次顺序写入日志
+ *
+ * 日志剩余空间不足时先做检查点；单个事务比整个日志区还大时退化为直接写回原位
+ *
+ * @return int
+ */
+int newfs_journal_commit()
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_journal_header_d *header;
+    struct newfs_jblock **jblocks;
+    int per_desc = NEWFS_JOURNAL_PER_DESC();
+    int cap = newfs_journal_cap();
+    int cnt, needed, used, i, j, k;
+    uint32_t checksum;
+    uint8_t *buf;
+
+    if (!journal->is_enabled || journal->txn_cnt == 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    jblocks = newfs_journal_collect(TRUE, &cnt);
+    needed = cnt + (cnt + per_desc - 1) / per_desc + 1;
+    used = (journal->tail - journal->head + cap) % cap;
+    if (used + needed >= cap && newfs_journal_checkpoint() != NEWFS_ERROR_NONE)
+    {
+        free(jblocks);
+        return -NEWFS_ERROR_IO;
+    }
+
+    if (needed >= cap)
+    {
+        NEWFS_DBG("[%s] transaction of %d blocks exceeds the journal, writing in place\n", __func__, cnt);
+        if (newfs_journal_write_home(jblocks, cnt, TRUE) != NEWFS_ERROR_NONE)
+        {
+            free(jblocks);
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; i < cnt; i++)
+        {
+            newfs_journal_forget(jblocks[i]->blk);
+        }
+    }
+    else
+    {
+        buf = (uint8_t *)calloc(needed, NEWFS_BLOCK_SZ());
+        for (i = 0, k = 0; i < cnt; i += per_desc)
+        {
+            header = (struct newfs_journal_header_d *)(buf + NEWFS_BLKS_SZ(k++));
+            header->magic = NEWFS_JOURNAL_MAGIC;
+            header->type = NEWFS_JOURNAL_DESC;
+            header->seq = journal->seq;
+            header->count = cnt - i < per_desc ? cnt - i : per_desc;
+            for (j = 0; j < header->count; j++)
+            {
+                header->blocks[j] = jblocks[i + j]->blk;
+                memcpy(buf + NEWFS_BLKS_SZ(k++), jblocks[i + j]->data, NEWFS_BLOCK_SZ());
+            }
+        }
+        checksum = newfs_journal_checksum(NEWFS_JOURNAL_CHECKSUM_INIT, buf, NEWFS_BLKS_SZ(k));
+        header = (struct newfs_journal_header_d *)(buf + NEWFS_BLKS_SZ(k));
+        header->magic = NEWFS_JOURNAL_MAGIC;
+        header->type = NEWFS_JOURNAL_COMMIT;
+        header->seq = journal->seq;
+        header->count = cnt;
+        header->checksum = checksum;
+
+        if (newfs_journal_put(journal->tail, buf, needed) != NEWFS_ERROR_NONE)
+        {
+            free(buf);
+            free(jblocks);
+            return -NEWFS_ERROR_IO;
+        }
+        free(buf);
+        for (i = 0; i < cnt; i++)
+        {
+            jblocks[i]->in_txn = FALSE;
+            jblocks[i]->is_committed = TRUE;
+            free(jblocks[i]->ckpt);
+            jblocks[i]->ckpt = NULL;
+        }
+        journal->txn_cnt = 0;
+        journal->tail = (journal->tail + needed) % cap;
+        journal->seq++;
+    }
+    free(jblocks);
+    journal->pending_committed = journal->pending_cnt;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 只读回放时把事务中的块放入缓存，后面的事务覆盖前面的
+ *
+ * @param blk 绝对块号
+ * @param image
+ */
+static void newfs_journal_cache_image(int blk, uint8_t *image)
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_jblock *jblock = newfs_journal_find(blk);
+
+    if (jblock == NULL)
+    {
+        jblock = (struct newfs_jblock *)calloc(1, sizeof(struct newfs_jblock));
+        jblock->blk = blk;
+        jblock->data = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+        jblock->next = journal->buckets[blk % NEWFS_JOURNAL_HASH];
+        journal->buckets[blk % NEWFS_JOURNAL_HASH] = jblock;
+        journal->cached_cnt++;
+    }
+    memcpy(jblock->data, image, NEWFS_BLOCK_SZ());
+}
+/**
+ * @brief 从head开始回放完整的事务，遇到序号不连续、块头非法或校验和不符即停止
+ *
+ * @param to_cache 为TRUE时不写盘，只把块放入缓存，读路径经newfs_journal_overlay看到回放后的内容
+ * @return int 回放的事务数
+ */
+static int newfs_journal_replay(boolean to_cache)
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_journal_header_d *header;
+    int cap = newfs_journal_cap();
+    int per_desc = NEWFS_JOURNAL_PER_DESC();
+    int limit = journal->offset / NEWFS_BLOCK_SZ();
+    uint8_t *block = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+    uint8_t *images = NULL;
+    int32_t *targets = NULL;
+    int replayed = 0, cnt, len, i;
+    uint32_t checksum;
+
+    header = (struct newfs_journal_header_d *)block;
+    for (;;)
+    {
+        cnt = 0;
+        len = 0;
+        checksum = NEWFS_JOURNAL_CHECKSUM_INIT;
+        for (;;)
+        {
+            if (len >= cap ||
+                newfs_driver_read(NEWFS_JOURNAL_OFS((journal->head + len) % cap), block,
+                                  NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE ||
+                header->magic != NEWFS_JOURNAL_MAGIC || header->seq != journal->head_seq)
+            {
+                goto out;
+            }
+            if (header->type == NEWFS_JOURNAL_COMMIT)
+            {
+                break;
+            }
+            if (header->type != NEWFS_JOURNAL_DESC || header->count > per_desc ||
+                len + 1 + header->count >= cap)
+            {
+                goto out;
+            }
+            checksum = newfs_journal_checksum(checksum, block, NEWFS_BLOCK_SZ());
+            targets = (int32_t *)realloc(targets, (cnt + header->count) * sizeof(int32_t));
+            images = (uint8_t *)realloc(images, NEWFS_BLKS_SZ((cnt + header->count)));
+            for (i = 0; i < header->count; i++)
+            {
+                targets[cnt + i] = header->blocks[i];
+                if (targets[cnt + i] < 0 || targets[cnt + i] >= limit ||
+                    newfs_driver_read(NEWFS_JOURNAL_OFS((journal->head + len + 1 + i) % cap),
+                                      images + NEWFS_BLKS_SZ((cnt + i)), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+                {
+                    goto out;
+                }
+                checksum = newfs_journal_checksum(checksum, images + NEWFS_BLKS_SZ((cnt + i)), NEWFS_BLOCK_SZ());
+            }
+            cnt += header->count;
+            len += 1 + header->count;
+        }
+        if (header->count != cnt || header->checksum != checksum)
+        {
+            goto out;
+        }
+        for (i = 0; i < cnt; i++)
+        {
+            if (to_cache)
+            {
+                newfs_journal_cache_image(targets[i], images + NEWFS_BLKS_SZ(i));
+            }
+            else if (newfs_driver_write(NEWFS_BLKS_SZ(targets[i]), images + NEWFS_BLKS_SZ(i),
+                                        NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+            {
+                goto out;
+            }
+        }
+        journal->head = (journal->head + len + 1) % cap;
+        journal->head_seq++;
+        replayed++;
+    }
+out:
+    free(block);
+    free(images);
+    free(targets);
+    return replayed;
+}
+/**
+ * @brief 读日志超级块，取得head与其序号
+ *
+ * @return int
+ */
+static int newfs_journal_read_super()
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_journal_super_d journal_super_d;
+
+    if (newfs_driver_read(journal->offset, (uint8_t *)&journal_super_d,
+                          sizeof(struct newfs_journal_super_d)) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    if (journal_super_d.magic != NEWFS_JOURNAL_MAGIC || journal_super_d.head < 0 ||
+        journal_super_d.head >= newfs_journal_cap())
+    {
+        NEWFS_DBG("[%s] bad journal superblock\n", __func__);
+        return -NEWFS_ERROR_INVAL;
+    }
+    journal->head = journal_super_d.head;
+    journal->head_seq = journal_super_d.seq;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 只读地回放日志：已提交的事务只装入缓存，磁盘不变，日志也不启用
+ *
+ * 供离线检查在不修复时使用，之后的newfs_driver_read看到的是回放后的内容。
+ * 调用前需已由磁盘超级块填好journal.offset与journal.blks
+ *
+ * @return int 待回放的事务数，出错时为负的错误码
+ */
+int newfs_journal_peek()
+{
+    int ret = newfs_journal_read_super();
+
+    return ret != NEWFS_ERROR_NONE ? ret : newfs_journal_replay(TRUE);
+}
+/**
+ * @brief 挂载时读取日志超级块并回放未检查点的事务，之后启用日志
+ *
+ * 调用前需已由磁盘超级块填好journal.offset与journal.blks
+ *
+ * @return int
+ */
+int newfs_journal_load()
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    int replayed, ret;
+
+    if ((ret = newfs_journal_read_super()) != NEWFS_ERROR_NONE)
+    {
+        return ret;
+    }
+    replayed = newfs_journal_replay(FALSE);
+    if (replayed > 0)
+    {
+        NEWFS_DBG("[%s] replayed %d transactions\n", __func__, replayed);
+        if (newfs_journal_write_super() != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    journal->tail = journal->head;
+    journal->seq = journal->head_seq;
+    journal->is_enabled = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 卸载时释放日志缓存，调用前应已提交并完成检查点
+ *
+ */
+void newfs_journal_destroy()
+{
+    struct newfs_journal *journal = &newfs_super.journal;
+    struct newfs_jblock *jblock;
+    int bucket;
+
+    for (bucket = 0; bucket < NEWFS_JOURNAL_HASH; bucket++)
+    {
+        while ((jblock = journal->buckets[bucket]) != NULL)
+        {
+            newfs_journal_forget(jblock->blk);
+        }
+    }
+    free(journal->pending_free);
+    memset(journal, 0, sizeof(struct newfs_journal));
+}
@@ -1,6 +1,12 @@
 #include "../include/newfs.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-extern struct newfs_super newfs_super;
+struct newfs_super newfs_super; /* 与mkfs.newfs共用，定义在此而非FUSE入口 */
+static struct newfs_slab newfs_inode_slab = {sizeof(struct newfs_inode), NULL, NULL, PTHREAD_MUTEX_INITIALIZER};
+static struct newfs_slab newfs_dentry_slab = {sizeof(struct newfs_dentry), NULL, NULL, PTHREAD_MUTEX_INITIALIZER};
+static char newfs_root_name[] = "/";
 extern struct custom_options newfs_options;
 
 /**
@@ -43,7 +49,7 @@ int newfs_calc_lvl(const char *path)
     return lvl;
 }
 /**
- * @brief 驱动读
+ * @brief 驱动读，日志缓存中尚未写回原位的元数据块优先于磁盘内容
  *
  * @param offset
  * @param out_content
@@ -55,23 +61,27 @@ int newfs_driver_read(int offset, uint8_t *out_content, int size)
     int offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_BLOCK_SZ());
     int bias = offset - offset_aligned;
     int size_aligned = NEWFS_ROUND_UP((size + bias), NEWFS_BLOCK_SZ());
+    int remain = size_aligned;
     uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
     uint8_t *cur = temp_content;
+    pthread_mutex_lock(&newfs_super.driver_lock);
     // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
     ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    while (remain != 0)
     {
         // read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
         ddriver_read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
         cur += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();
+        remain -= NEWFS_IO_SZ();
     }
+    pthread_mutex_unlock(&newfs_super.driver_lock);
+    newfs_journal_overlay(offset_aligned, temp_content, size_aligned);
     memcpy(out_content, temp_content + bias, size);
     free(temp_content);
     return NEWFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 驱动写，直接写到原位；整块对齐的写不必先读
  *
  * @param offset
  * @param in_content
@@ -85,9 +95,13 @@ int newfs_driver_write(int offset, uint8_t *in_content, int size)
     int size_aligned = NEWFS_ROUND_UP((size + bias), NEWFS_BLOCK_SZ());
     uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
     uint8_t *cur = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
+    if (bias != 0 || size != size_aligned)
+    {
+        newfs_driver_read(offset_aligned, temp_content, size_aligned);
+    }
     memcpy(temp_content + bias, in_content, size);
 
+    pthread_mutex_lock(&newfs_super.driver_lock);
     // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
     ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
     while (size_aligned != 0)
@@ -97,71 +111,490 @@ int newfs_driver_write(int offset, uint8_t *in_content, int size)
         cur += NEWFS_IO_SZ();
         size_aligned -= NEWFS_IO_SZ();
     }
+    pthread_mutex_unlock(&newfs_super.driver_lock);
 
     free(temp_content);
     return NEWFS_ERROR_NONE;
 }
 /**
- * @brief 为一个inode分配dentry，采用头插法
+ * @brief 记入缓存占用；超出cache_kick时唤醒回写线程去淘汰
  *
- * @param inode
+ * @param bytes 新分配的字节数
+ */
+static void newfs_cache_charge(long bytes)
+{
+    pthread_mutex_lock(&newfs_super.cache_lock);
+    newfs_super.cache_bytes += bytes;
+    if (newfs_super.cache_budget > 0 && newfs_super.cache_bytes > newfs_super.cache_kick)
+    {
+        pthread_cond_signal(&newfs_super.writeback_cond);
+    }
+    pthread_mutex_unlock(&newfs_super.cache_lock);
+}
+/**
+ * @brief 从slab取一个清零的对象，空闲链表为空时一次申请NEWFS_SLAB_CHUNK字节切分
+ *
+ * @param slab
+ * @return void*
+ */
+static void *newfs_slab_alloc(struct newfs_slab *slab)
+{
+    uint8_t *chunk;
+    void *obj;
+    int cnt, i;
+
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list == NULL)
+    { /* 块头留一个指针串起各块；倒序入链，取用时地址递增 */
+        chunk = (uint8_t *)malloc(NEWFS_SLAB_CHUNK);
+        *(void **)chunk = slab->chunks;
+        slab->chunks = chunk;
+        cnt = (NEWFS_SLAB_CHUNK - sizeof(void *)) / slab->obj_sz;
+        for (i = cnt - 1; i >= 0; i--)
+        {
+            obj = chunk + sizeof(void *) + i * slab->obj_sz;
+            *(void **)obj = slab->free_list;
+            slab->free_list = obj;
+        }
+    }
+    obj = slab->free_list;
+    slab->free_list = *(void **)obj;
+    pthread_mutex_unlock(&slab->lock);
+    memset(obj, 0, slab->obj_sz);
+    return obj;
+}
+/**
+ * @brief 把对象还给slab的空闲链表
+ *
+ * @param slab
+ * @param obj
+ */
+static void newfs_slab_free(struct newfs_slab *slab, void *obj)
+{
+    pthread_mutex_lock(&slab->lock);
+    *(void **)obj = slab->free_list;
+    slab->free_list = obj;
+    pthread_mutex_unlock(&slab->lock);
+}
+/**
+ * @brief 卸载时归还slab的全部块，此时其中不再有在用的对象
+ *
+ * @param slab
+ */
+static void newfs_slab_destroy(struct newfs_slab *slab)
+{
+    void *chunk, *next;
+
+    pthread_mutex_lock(&slab->lock);
+    for (chunk = slab->chunks; chunk; chunk = next)
+    {
+        next = *(void **)chunk;
+        free(chunk);
+    }
+    slab->chunks = NULL;
+    slab->free_list = NULL;
+    pthread_mutex_unlock(&slab->lock);
+}
+/**
+ * @brief 把文件名复制进arena，调用者需持有arena所属目录inode的写锁
+ *
+ * @param arena
+ * @param fname
+ * @return char*
+ */
+static char *newfs_arena_strdup(struct newfs_arena *arena, const char *fname)
+{
+    struct newfs_arena_chunk *chunk = arena->chunks;
+    int len = strlen(fname) + 1;
+    int size;
+    char *dst;
+
+    if (chunk == NULL || chunk->size - arena->used < len)
+    { /* 小目录只占一个小块，大目录的块逐次翻倍 */
+        size = chunk ? chunk->size * 2 : NEWFS_ARENA_MIN;
+        size = size < NEWFS_ARENA_MAX ? size : NEWFS_ARENA_MAX;
+        chunk = (struct newfs_arena_chunk *)malloc(sizeof(struct newfs_arena_chunk) + size);
+        chunk->next = arena->chunks;
+        chunk->size = size;
+        arena->chunks = chunk;
+        arena->used = 0;
+        newfs_cache_charge(sizeof(struct newfs_arena_chunk) + size);
+    }
+    dst = chunk->data + arena->used;
+    memcpy(dst, fname, len);
+    arena->used += len;
+    return dst;
+}
+/**
+ * @brief 释放arena中的全部文件名
+ *
+ * @param arena
+ * @return long 释放的字节数
+ */
+static long newfs_arena_free(struct newfs_arena *arena)
+{
+    struct newfs_arena_chunk *chunk, *next;
+    long bytes = 0;
+
+    for (chunk = arena->chunks; chunk; chunk = next)
+    {
+        next = chunk->next;
+        bytes += sizeof(struct newfs_arena_chunk) + chunk->size;
+        free(chunk);
+    }
+    arena->chunks = NULL;
+    arena->used = 0;
+    return bytes;
+}
+/**
+ * @brief 新建dentry，文件名存入父目录的names
+ *
+ * @param parent 父目录inode，调用者需持有其写锁；为NULL时是根目录
+ * @param fname
+ * @param ftype
+ * @return struct newfs_dentry*
+ */
+static struct newfs_dentry *newfs_new_dentry(struct newfs_inode *parent, const char *fname,
+                                             NEWFS_FILE_TYPE ftype)
+{
+    struct newfs_dentry *dentry = (struct newfs_dentry *)newfs_slab_alloc(&newfs_dentry_slab);
+
+    dentry->fname = parent ? newfs_arena_strdup(&parent->names, fname) : newfs_root_name;
+    dentry->ftype = ftype;
+    dentry->ino = -1;
+    return dentry;
+}
+/**
+ * @brief 文件名hash（FNV-1a），决定目录项在索引目录中落在哪个叶块
+ *
+ * @param fname
+ * @return uint32_t
+ */
+static uint32_t newfs_name_hash(const char *fname)
+{
+    uint32_t hash = 2166136261u;
+    while (*fname)
+    {
+        hash = (hash ^ (uint8_t)*fname++) * 16777619u;
+    }
+    return hash;
+}
+/**
+ * @brief 在hashes[from, cnt)中找第一个等于hash的下标，有SSE2时一次比较4个
+ *
+ * @param hashes
+ * @param from
+ * @param cnt
+ * @param hash
+ * @return int 找不到返回cnt
+ */
+static int newfs_hash_scan(const uint32_t *hashes, int from, int cnt, uint32_t hash)
+{
+#if defined(__SSE2__)
+    __m128i key = _mm_set1_epi32((int)hash);
+    int mask;
+
+    for (; from + 4 <= cnt; from += 4)
+    {
+        mask = _mm_movemask_ps(_mm_castsi128_ps(
+            _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(hashes + from)), key)));
+        if (mask)
+        {
+            return from + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; from < cnt; from++)
+    {
+        if (hashes[from] == hash)
+        {
+            return from;
+        }
+    }
+    return cnt;
+}
+/**
+ * @brief 把dentry放进目录的dentrys第pos个位置，数组满时容量翻倍，调用者需持有目录inode的写锁
+ *
+ * @param inode 目录inode
  * @param dentry
- * @return int
+ * @param pos [0, dentry_cnt]
  */
-int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
+static void newfs_insert_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry, int pos)
 {
-    if (inode->dentrys == NULL)
+    int cap;
+
+    if (inode->dentry_cnt == inode->dentry_cap)
+    {
+        cap = inode->dentry_cap ? inode->dentry_cap * 2 : NEWFS_DENTRY_CAP_MIN;
+        inode->dentrys = (struct newfs_dentry **)realloc(inode->dentrys, cap * sizeof(struct newfs_dentry *));
+        inode->hashes = (uint32_t *)realloc(inode->hashes, cap * sizeof(uint32_t));
+        newfs_cache_charge((long)(cap - inode->dentry_cap) * (sizeof(struct newfs_dentry *) + sizeof(uint32_t)));
+        inode->dentry_cap = cap;
+    }
+    memmove(inode->dentrys + pos + 1, inode->dentrys + pos,
+            (inode->dentry_cnt - pos) * sizeof(struct newfs_dentry *));
+    memmove(inode->hashes + pos + 1, inode->hashes + pos, (inode->dentry_cnt - pos) * sizeof(uint32_t));
+    inode->dentrys[pos] = dentry;
+    inode->hashes[pos] = newfs_name_hash(dentry->fname);
+    inode->dentry_cnt++;
+    if (dentry->inode == NULL)
+    {
+        inode->unloaded_cnt++;
+    }
+    newfs_cache_charge(sizeof(struct newfs_dentry));
+}
+/**
+ * @brief 把刚装入或新建的inode放到缓存链表头部并记入占用，根inode不调用
+ *
+ * @param inode
+ */
+static void newfs_cache_add(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_super.cache_lock);
+    inode->lru_prev = NULL;
+    inode->lru_next = newfs_super.lru_head;
+    if (newfs_super.lru_head)
     {
-        inode->dentrys = dentry;
+        newfs_super.lru_head->lru_prev = inode;
     }
     else
     {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+        newfs_super.lru_tail = inode;
     }
-    inode->dir_cnt++;
-    return inode->dir_cnt;
+    newfs_super.lru_head = inode;
+    pthread_mutex_unlock(&newfs_super.cache_lock);
+    newfs_cache_charge(sizeof(struct newfs_inode));
 }
 /**
- * @brief 分配一个inode，占用位图
+ * @brief 从缓存链表摘下，调用者需持有cache_lock
  *
- * @param dentry 该dentry指向分配的inode
- * @return newfs_inode
+ * @param inode
  */
-struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
+static void newfs_cache_unlink(struct newfs_inode *inode)
 {
-    struct newfs_inode *inode;
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    boolean is_find_free_entry = FALSE;
+    if (inode->lru_prev)
+    {
+        inode->lru_prev->lru_next = inode->lru_next;
+    }
+    else
+    {
+        newfs_super.lru_head = inode->lru_next;
+    }
+    if (inode->lru_next)
+    {
+        inode->lru_next->lru_prev = inode->lru_prev;
+    }
+    else
+    {
+        newfs_super.lru_tail = inode->lru_prev;
+    }
+    inode->lru_prev = inode->lru_next = NULL;
+}
+/**
+ * @brief 查找命中时把inode移到缓存链表头部
+ *
+ * @param inode
+ */
+static void newfs_cache_touch(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_super.cache_lock);
+    if (newfs_super.lru_head != inode && (inode->lru_prev || inode->lru_next))
+    {
+        newfs_cache_unlink(inode);
+        inode->lru_next = newfs_super.lru_head;
+        newfs_super.lru_head->lru_prev = inode;
+        newfs_super.lru_head = inode;
+    }
+    pthread_mutex_unlock(&newfs_super.cache_lock);
+}
+/**
+ * @brief 增加引用，被引用的inode不会被淘汰，指针在引用期间一直有效
+ *
+ * @param inode
+ */
+void newfs_inode_get(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_super.cache_lock);
+    inode->refcnt++;
+    pthread_mutex_unlock(&newfs_super.cache_lock);
+}
+/**
+ * @brief 释放newfs_inode_get取得的引用
+ *
+ * @param inode
+ */
+void newfs_inode_put(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_super.cache_lock);
+    inode->refcnt--;
+    pthread_mutex_unlock(&newfs_super.cache_lock);
+}
+/**
+ * @brief 释放内存inode及其数据块缓存；目录连同其下的目录项与已装入的子inode一并释放
+ *
+ * @param inode
+ * @return long 释放的缓存占用（只计子树中的目录项与数据块，以及inode本身）
+ */
+static long newfs_free_inode(struct newfs_inode *inode)
+{
+    long bytes = sizeof(struct newfs_inode);
+    int bcnt, i;
 
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_inode_blks);
-         byte_cursor++)
+    for (i = 0; i < inode->dentry_cnt; i++)
+    {
+        if (inode->dentrys[i]->inode)
+        {
+            bytes += newfs_free_inode(inode->dentrys[i]->inode);
+        }
+        newfs_slab_free(&newfs_dentry_slab, inode->dentrys[i]);
+        bytes += sizeof(struct newfs_dentry);
+    }
+    bytes += (long)inode->dentry_cap * (sizeof(struct newfs_dentry *) + sizeof(uint32_t));
+    free(inode->dentrys);
+    free(inode->hashes);
+    bytes += newfs_arena_free(&inode->names);
+    for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+        if (inode->block_flag[bcnt] & NEWFS_FLAG_BUF_OCCUPY)
+        {
+            free(inode->data_block_pointer[bcnt]);
+            bytes += NEWFS_BLOCK_SZ();
+        }
+    }
+    pthread_rwlock_destroy(&inode->lock);
+    newfs_slab_free(&newfs_inode_slab, inode);
+    return bytes;
+}
+/**
+ * @brief inode能否淘汰：未被引用、已回写，目录则其下不能有已装入的子inode
+ *
+ * @param inode
+ * @return boolean
+ */
+static boolean newfs_can_evict(struct newfs_inode *inode)
+{
+    return inode->refcnt == 0 && !inode->is_dirty && inode->unloaded_cnt == inode->dentry_cnt;
+}
+/**
+ * @brief 从缓存链表尾部起淘汰干净且未被引用的inode，直到回到预算以内
+ *
+ * 淘汰后dentry->inode置为NULL，下次查找时newfs_dir_lookup从磁盘重新装入；
+ * 目录的子inode都被淘汰后目录自身才能淘汰，其目录项随之释放。
+ * 调用者需独占持有tree_lock，期间没有操作持有inode或dentry指针
+ */
+void newfs_cache_shrink()
+{
+    struct newfs_inode *inode, *prev;
+    boolean is_progress = TRUE;
+    long bytes;
+
+    pthread_mutex_lock(&newfs_super.cache_lock);
+    while (is_progress && newfs_super.cache_budget > 0 && newfs_super.cache_bytes > newfs_super.cache_budget)
+    { /* 子inode淘汰后父目录才可淘汰，父目录若在更靠尾部的位置需要再扫一遍 */
+        is_progress = FALSE;
+        for (inode = newfs_super.lru_tail;
+             inode && newfs_super.cache_bytes > newfs_super.cache_budget; inode = prev)
         {
-            if ((newfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0)
+            prev = inode->lru_prev;
+            if (!newfs_can_evict(inode))
             {
-                /* 当前ino_cursor位置空闲 */
-                newfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;
-                break;
+                continue;
             }
-            ino_cursor++;
+            newfs_cache_unlink(inode);
+            inode->dentry->inode = NULL;
+            inode->dentry->parent->inode->unloaded_cnt++; /* 根inode常驻，被淘汰的总有父目录 */
+            bytes = newfs_free_inode(inode);
+            newfs_super.cache_bytes -= bytes;
+            is_progress = TRUE;
         }
-        if (is_find_free_entry)
+    }
+    /* 被引用或脏的inode淘汰不掉时，再多占用预算的1/4才重新唤醒，避免回写线程空转 */
+    newfs_super.cache_kick = newfs_super.cache_bytes > newfs_super.cache_budget ? newfs_super.cache_bytes
+                                                                               : newfs_super.cache_budget;
+    newfs_super.cache_kick += newfs_super.cache_budget / 4;
+    pthread_mutex_unlock(&newfs_super.cache_lock);
+}
+/**
+ * @brief 为一个inode分配dentry，追加在dentrys末尾
+ *
+ * @param inode
+ * @param dentry
+ * @return int
+ */
+int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
+{
+    newfs_insert_dentry(inode, dentry, inode->dentry_cnt);
+    if (inode->dirty_from > inode->dir_cnt)
+    {
+        inode->dirty_from = inode->dir_cnt; /* 新目录项落在磁盘上的第dir_cnt个位置 */
+    }
+    inode->dir_cnt++;
+    inode->size += NEWFS_DENTRY_REC_LEN(strlen(dentry->fname));
+    return inode->dir_cnt;
+}
+/**
+ * @brief 从goal组开始依次在各组位图中占用一个空闲位
+ *
+ * @param map 各组位图首尾相接
+ * @param per_group 每组的位数
+ * @param total 全部有效位数，末组可能不满
+ * @param goal 首选位，在其所在组内从该位向后找，找不到再依次试后面的组
+ * @param free_cnt 该位图的空闲计数，占用成功时减一
+ * @return int 全局下标，无空闲时返回-NEWFS_ERROR_NOSPACE
+ */
+static int newfs_group_alloc(uint8_t *map, int per_group, int total, int goal, int *free_cnt)
+{
+    int goal_group = goal / per_group;
+    int i, group, from, cnt, bit;
+
+    pthread_mutex_lock(&newfs_super.bitmap_lock);
+    for (i = 0; i <= newfs_super.groups_cnt; i++)
+    {
+        group = (goal_group + i) % newfs_super.groups_cnt;
+        from = i == 0 ? goal % per_group : 0;
+        cnt = total - group * per_group < per_group ? total - group * per_group : per_group;
+        bit = newfs_bitmap_find(map + NEWFS_BLKS_SZ(group), from, cnt);
+        if (bit >= 0)
         {
-            break;
+            map[NEWFS_BLKS_SZ(group) + bit / UINT8_BITS] |= (0x1 << (bit % UINT8_BITS));
+            (*free_cnt)--;
+            newfs_super.group_dirty[group] = TRUE;
+            newfs_super.is_super_dirty = TRUE;
+            pthread_mutex_unlock(&newfs_super.bitmap_lock);
+            return group * per_group + bit;
         }
     }
+    pthread_mutex_unlock(&newfs_super.bitmap_lock);
+    return -NEWFS_ERROR_NOSPACE;
+}
+/**
+ * @brief 分配一个inode，占用位图；优先放在父目录所在的组，使同一目录的inode集中在一段inode表中
+ *
+ * @param dentry 该dentry指向分配的inode
+ * @return newfs_inode 无空闲inode时返回NULL
+ */
+struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
+{
+    struct newfs_inode *inode;
+    int ino_cursor;
+    int goal = 0;
+    int bcnt;
 
-    if (!is_find_free_entry || ino_cursor == newfs_super.max_ino)
-        return -NEWFS_ERROR_NOSPACE;
+    if (dentry->parent && dentry->parent->ino >= 0)
+    {
+        goal = NEWFS_INO_GROUP(dentry->parent->ino) * newfs_super.inodes_per_group;
+    }
+    ino_cursor = newfs_group_alloc(newfs_super.map_inode, newfs_super.inodes_per_group,
+                                   newfs_super.max_ino, goal, &newfs_super.free_ino);
+    if (ino_cursor < 0)
+        return NULL;
 
-    inode = (struct newfs_inode *)malloc(sizeof(struct newfs_inode));
+    inode = (struct newfs_inode *)newfs_slab_alloc(&newfs_inode_slab);
     inode->ino = ino_cursor;
     inode->size = 0;
+    inode->atime = inode->mtime = inode->ctime = time(NULL);
+    pthread_rwlock_init(&inode->lock, NULL);
 
     /* dentry指向inode */
     dentry->inode = inode;
@@ -170,118 +603,1798 @@ struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
     inode->dentry = dentry;
 
     inode->dir_cnt = 0;
+    inode->is_indexed = FALSE;
+    inode->is_complete = TRUE;
+    inode->dirty_from = 0;
     inode->dentrys = NULL;
+    inode->hashes = NULL;
+    inode->dentry_cnt = inode->dentry_cap = 0;
+    inode->unloaded_cnt = 0;
+    for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+    {
+        inode->bno[bcnt] = NEWFS_INVALID_BNO;
+        inode->data_block_pointer[bcnt] = NULL;
+        inode->block_flag[bcnt] = 0;
+    }
+
+    inode->is_dirty = FALSE;
+    inode->refcnt = 0;
+    inode->lru_prev = inode->lru_next = NULL;
+    newfs_mark_dirty(inode); /* 新inode尚未落盘 */
 
     return inode;
 }
 /**
- * @brief 查找当前data_map中的空闲位置
+ * @brief 在数据位图中占用一个空闲块，尽量靠近goal
  *
- * @param inode
- * @param bcnt
+ * @param goal 首选块号
+ * @return int 块号，无空闲块时返回-NEWFS_ERROR_NOSPACE
+ */
+static int newfs_alloc_bno(int goal)
+{
+    return newfs_group_alloc(newfs_super.map_data, newfs_super.data_per_group,
+                             newfs_super.max_data, goal, &newfs_super.free_data);
+}
+/**
+ * @brief 在数据位图中占用一段连续的空闲块，连续段不跨组
+ *
+ * 从goal开始依次扫描各组，取第一段不短于want的空闲段；都不够长时取扫描到的最长段，
+ * 调用者对剩余部分再次分配
+ *
+ * @param goal 首选块号
+ * @param want 需要的块数
+ * @param got 输出实际占用的块数
+ * @return int 起始块号，无空闲块时返回-NEWFS_ERROR_NOSPACE
  */
-void newfs_find_free_block(struct newfs_inode *inode, int bcnt)
+static int newfs_alloc_run(int goal, int want, int *got)
 {
-    int byte_cursor, bit_cursor, bno_cursor = 0;
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_data_blks);
-         byte_cursor++)
+    int per_group = newfs_super.data_per_group;
+    int goal_group = goal / per_group;
+    int best = -1, best_len = 0;
+    int i, group, bit, cnt, len;
+    uint8_t *map;
+
+    pthread_mutex_lock(&newfs_super.bitmap_lock);
+    for (i = 0; i <= newfs_super.groups_cnt && best_len < want; i++)
     {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
+        group = (goal_group + i) % newfs_super.groups_cnt;
+        map = newfs_super.map_data + NEWFS_BLKS_SZ(group);
+        cnt = newfs_super.max_data - group * per_group < per_group ? newfs_super.max_data - group * per_group
+                                                                  : per_group;
+        for (bit = i == 0 ? goal % per_group : 0; bit < cnt && best_len < want; bit += len + 1)
         {
-            if ((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0)
+            bit = newfs_bitmap_find(map, bit, cnt);
+            if (bit < 0)
+            {
+                break;
+            }
+            len = newfs_bitmap_run(map, bit, cnt, want);
+            if (len > best_len)
             {
-                /* 当前bno_cursor位置空闲 */
-                newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                inode->bno[bcnt] = bno_cursor;
-                return;
+                best = group * per_group + bit;
+                best_len = len;
             }
-            bno_cursor++;
         }
     }
-    free(inode);
-    return -NEWFS_ERROR_NOSPACE;
+    if (best < 0)
+    {
+        pthread_mutex_unlock(&newfs_super.bitmap_lock);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    group = NEWFS_BNO_GROUP(best);
+    map = newfs_super.map_data + NEWFS_BLKS_SZ(group);
+    for (bit = best % per_group; bit < best % per_group + best_len; bit++)
+    {
+        map[bit / UINT8_BITS] |= (0x1 << (bit % UINT8_BITS));
+    }
+    newfs_super.free_data -= best_len;
+    newfs_super.group_dirty[group] = TRUE;
+    newfs_super.is_super_dirty = TRUE;
+    pthread_mutex_unlock(&newfs_super.bitmap_lock);
+    *got = best_len;
+    return best;
+}
+/**
+ * @brief 在数据位图中清除一个块，日志启用时只能由检查点调用
+ *
+ * @param bno
+ */
+void newfs_release_bno(int bno)
+{
+    int group = NEWFS_BNO_GROUP(bno);
+    int bit = bno % newfs_super.data_per_group;
+
+    pthread_mutex_lock(&newfs_super.bitmap_lock);
+    newfs_super.map_data[NEWFS_BLKS_SZ(group) + bit / UINT8_BITS] &= ~(0x1 << (bit % UINT8_BITS));
+    newfs_super.free_data++;
+    newfs_super.group_dirty[group] = TRUE;
+    newfs_super.is_super_dirty = TRUE;
+    pthread_mutex_unlock(&newfs_super.bitmap_lock);
+}
+/**
+ * @brief 归还一个数据块，日志启用时推迟到下一次检查点
+ *
+ * @param bno
+ */
+static void newfs_free_bno(int bno)
+{
+    if (newfs_super.journal.is_enabled)
+    {
+        newfs_journal_defer_free(bno);
+        return;
+    }
+    newfs_release_bno(bno);
+}
+/**
+ * @brief 为inode的第bcnt个数据块分配块号，仅在该块首次需要落盘时调用，分配后映射保持不变
+ *
+ * 紧跟前一个数据块分配以保持连续；第一块放在inode所在组，靠近inode表
+ *
+ * @param inode
+ * @param bcnt
+ * @return int
+ */
+int newfs_find_free_block(struct newfs_inode *inode, int bcnt)
+{
+    int goal = NEWFS_INO_GROUP(inode->ino) * newfs_super.data_per_group;
+    int bno;
+
+    if (bcnt > 0 && inode->bno[bcnt - 1] != NEWFS_INVALID_BNO)
+    {
+        goal = inode->bno[bcnt - 1] + 1;
+    }
+    bno = newfs_alloc_bno(goal < newfs_super.max_data ? goal : 0);
+    if (bno < 0)
+    {
+        return bno;
+    }
+    inode->bno[bcnt] = bno;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 延迟分配：回写时才为文件已缓存、尚无块号的数据块分配块号
+ *
+ * 文件大小范围内连续待分配的块合并为一次分配，取一段连续空闲块，紧跟前一个已分配的块；
+ * 多次小追加写因此落在连续的块上，且每次回写只调用一次分配器。
+ * 新分配的块标记为脏，由调用者写出；未缓存的块是空洞，读时为零，不分配
+ *
+ * @param inode 普通文件inode
+ * @return int
+ */
+static int newfs_alloc_file_blocks(struct newfs_inode *inode)
+{
+    int last = NEWFS_ROUND_UP(inode->size, NEWFS_BLOCK_SZ()) / NEWFS_BLOCK_SZ();
+    int bcnt, want, got, bno, goal, i;
+
+    last = last < NEWFS_DATA_PER_FILE ? last : NEWFS_DATA_PER_FILE;
+    for (bcnt = 0; bcnt < last;)
+    {
+        if (inode->bno[bcnt] != NEWFS_INVALID_BNO || !(inode->block_flag[bcnt] & NEWFS_FLAG_BUF_OCCUPY))
+        {
+            bcnt++;
+            continue;
+        }
+        for (want = 1; bcnt + want < last && inode->bno[bcnt + want] == NEWFS_INVALID_BNO &&
+                       (inode->block_flag[bcnt + want] & NEWFS_FLAG_BUF_OCCUPY);
+             want++)
+            ;
+        goal = NEWFS_INO_GROUP(inode->ino) * newfs_super.data_per_group;
+        if (bcnt > 0 && inode->bno[bcnt - 1] != NEWFS_INVALID_BNO)
+        {
+            goal = inode->bno[bcnt - 1] + 1;
+        }
+        bno = newfs_alloc_run(goal < newfs_super.max_data ? goal : 0, want, &got);
+        if (bno < 0)
+        {
+            return bno;
+        }
+        for (i = 0; i < got; i++)
+        {
+            inode->bno[bcnt + i] = bno + i;
+            inode->block_flag[bcnt + i] |= NEWFS_FLAG_BUF_DIRTY;
+        }
+        bcnt += got;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 取得文件第bcnt个数据块的内存缓存，首次访问时才从磁盘读入，此后常驻
+ *
+ * 未分配块号的块直接给出全零缓存，不产生IO
+ *
+ * @param inode 文件inode
+ * @param bcnt [0...NEWFS_DATA_PER_FILE)
+ * @return uint8_t* 失败返回NULL
+ */
+uint8_t *newfs_load_block(struct newfs_inode *inode, int bcnt)
+{
+    if (inode->block_flag[bcnt] & NEWFS_FLAG_BUF_OCCUPY)
+    {
+        return inode->data_block_pointer[bcnt];
+    }
+
+    inode->data_block_pointer[bcnt] = (uint8_t *)calloc(1, NEWFS_BLOCK_SZ());
+    if (inode->bno[bcnt] != NEWFS_INVALID_BNO &&
+        newfs_driver_read(NEWFS_DATA_OFS(inode->bno[bcnt]), inode->data_block_pointer[bcnt],
+                          NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        free(inode->data_block_pointer[bcnt]);
+        inode->data_block_pointer[bcnt] = NULL;
+        return NULL;
+    }
+    inode->block_flag[bcnt] |= NEWFS_FLAG_BUF_OCCUPY;
+    newfs_cache_charge(NEWFS_BLOCK_SZ());
+    return inode->data_block_pointer[bcnt];
+}
+/**
+ * @brief 写文件：只修改页缓存并标脏，块号与落盘都推迟到回写，重叠的小写在内存中合并
+ *
+ * 首尾不满一页的部分先由newfs_load_block读入再局部覆盖；整页覆盖的页不必读盘。
+ * 数据由fuse_buf_copy逐页拷入缓存块，来源是内核splice过来的管道时不经中间缓冲
+ *
+ * @param inode 普通文件inode
+ * @param src 写入的内容，拷贝后游标随之前移
+ * @param offset 文件内偏移
+ * @return int 写入的字节数，超出单文件上限的部分被截去；失败返回负的错误码
+ */
+int newfs_write_bufvec(struct newfs_inode *inode, struct fuse_bufvec *src, int offset)
+{
+    int max = NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE);
+    int size = (int)fuse_buf_size(src);
+    int done, bcnt, ofs, len;
+    boolean fresh;
+    struct fuse_bufvec dst;
+    ssize_t copied = 0;
+    uint8_t *block;
+
+    if (offset >= max)
+    {
+        return -NEWFS_ERROR_FBIG;
+    }
+    size = size < max - offset ? size : max - offset;
+    for (done = 0; done < size; done += len)
+    {
+        bcnt = (offset + done) / NEWFS_BLOCK_SZ();
+        ofs = (offset + done) % NEWFS_BLOCK_SZ();
+        len = NEWFS_BLOCK_SZ() - ofs < size - done ? NEWFS_BLOCK_SZ() - ofs : size - done;
+        fresh = len == NEWFS_BLOCK_SZ() && !(inode->block_flag[bcnt] & NEWFS_FLAG_BUF_OCCUPY);
+        if (fresh)
+        {
+            inode->data_block_pointer[bcnt] = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+            inode->block_flag[bcnt] |= NEWFS_FLAG_BUF_OCCUPY;
+            newfs_cache_charge(NEWFS_BLOCK_SZ());
+        }
+        block = newfs_load_block(inode, bcnt);
+        if (block == NULL)
+        {
+            break;
+        }
+        dst = FUSE_BUFVEC_INIT(len);
+        dst.buf[0].mem = block + ofs;
+        copied = fuse_buf_copy(&dst, src, 0);
+        if (fresh && copied < len)
+        { /* 来源提前结束，未覆盖的部分不能留下未初始化的内容 */
+            memset(block + (copied > 0 ? copied : 0), 0, NEWFS_BLOCK_SZ() - (copied > 0 ? copied : 0));
+        }
+        if (copied <= 0)
+        {
+            break;
+        }
+        inode->block_flag[bcnt] |= NEWFS_FLAG_BUF_DIRTY;
+        len = (int)copied;
+    }
+    if (done == 0 && size > 0)
+    {
+        return copied < 0 ? (int)copied : -NEWFS_ERROR_IO;
+    }
+    if (offset + done > inode->size)
+    {
+        inode->size = offset + done;
+    }
+    inode->mtime = inode->ctime = time(NULL);
+    newfs_mark_dirty(inode);
+    return done;
+}
+/**
+ * @brief 写文件，内容来自内存
+ *
+ * @param inode 普通文件inode
+ * @param buf
+ * @param size
+ * @param offset 文件内偏移
+ * @return int 同newfs_write_bufvec
+ */
+int newfs_write_data(struct newfs_inode *inode, const char *buf, int size, int offset)
+{
+    struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+
+    src.buf[0].mem = (void *)buf;
+    return newfs_write_bufvec(inode, &src, offset);
+}
+/**
+ * @brief 设置访问与修改时间（utimens/setattr），调用者需持有inode的写锁
+ *
+ * @param inode
+ * @param atime
+ * @param mtime
+ */
+void newfs_set_times(struct newfs_inode *inode, time_t atime, time_t mtime)
+{
+    inode->atime = atime;
+    inode->mtime = mtime;
+    inode->ctime = time(NULL);
+    newfs_mark_dirty(inode);
+}
+/**
+ * @brief 读文件：页首次访问时读盘，此后从页缓存返回
+ *
+ * @param inode 普通文件inode
+ * @param buf
+ * @param size
+ * @param offset 文件内偏移
+ * @return int 读到的字节数，到文件尾为止；失败返回负的错误码
+ */
+int newfs_read_data(struct newfs_inode *inode, char *buf, int size, int offset)
+{
+    int done, bcnt, ofs, len;
+    uint8_t *block;
+
+    if (offset >= inode->size)
+    {
+        return 0;
+    }
+    size = size < inode->size - offset ? size : inode->size - offset;
+    for (done = 0; done < size; done += len)
+    {
+        bcnt = (offset + done) / NEWFS_BLOCK_SZ();
+        ofs = (offset + done) % NEWFS_BLOCK_SZ();
+        len = NEWFS_BLOCK_SZ() - ofs < size - done ? NEWFS_BLOCK_SZ() - ofs : size - done;
+        block = newfs_load_block(inode, bcnt);
+        if (block == NULL)
+        {
+            return done > 0 ? done : -NEWFS_ERROR_IO;
+        }
+        memcpy(buf + done, block + ofs, len);
+    }
+    return done;
+}
+/**
+ * @brief 本次读覆盖的块是否都已在页缓存中，是则读路径不会修改inode，持读锁即可
+ *
+ * @param inode 普通文件inode
+ * @param offset
+ * @param size
+ * @return boolean
+ */
+boolean newfs_is_cached(struct newfs_inode *inode, int offset, int size)
+{
+    int bcnt, last;
+
+    if (offset >= inode->size || size <= 0)
+    {
+        return TRUE;
+    }
+    size = size < inode->size - offset ? size : inode->size - offset;
+    last = (offset + size - 1) / NEWFS_BLOCK_SZ();
+    for (bcnt = offset / NEWFS_BLOCK_SZ(); bcnt <= last; bcnt++)
+    {
+        if (!(inode->block_flag[bcnt] & NEWFS_FLAG_BUF_OCCUPY))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+/**
+ * @brief 把[first, first + cnt)中尚未缓存且已分配块号的块读入页缓存，块号连续的合并为一次设备读
+ *
+ * 调用者持有inode写锁。先在锁内记下要读的各段，设备读期间放开inode锁，命中缓存的读与
+ * 其他文件不受阻塞；重新加锁后只装入仍未缓存、块号也未变的块（期间可能已被写入或读入）。
+ * 共享持有的tree_lock保证inode不会被淘汰
+ *
+ * @param inode 普通文件inode
+ * @param first
+ * @param cnt
+ */
+static void newfs_prefetch_blocks(struct newfs_inode *inode, int first, int cnt)
+{
+    int last = first + cnt;
+    int starts[NEWFS_DATA_PER_FILE], lens[NEWFS_DATA_PER_FILE], bnos[NEWFS_DATA_PER_FILE];
+    uint8_t *runs[NEWFS_DATA_PER_FILE];
+    int run_cnt = 0, bcnt, next, r, i, charged;
+
+    for (bcnt = first; bcnt < last; bcnt = next)
+    {
+        next = bcnt + 1;
+        if ((inode->block_flag[bcnt] & NEWFS_FLAG_BUF_OCCUPY) || inode->bno[bcnt] == NEWFS_INVALID_BNO)
+        {
+            continue;
+        }
+        while (next < last && !(inode->block_flag[next] & NEWFS_FLAG_BUF_OCCUPY) &&
+               inode->bno[next] == inode->bno[next - 1] + 1 &&
+               NEWFS_BNO_GROUP(inode->bno[next]) == NEWFS_BNO_GROUP(inode->bno[bcnt]))
+        {
+            next++;
+        }
+        starts[run_cnt] = bcnt;
+        lens[run_cnt] = next - bcnt;
+        bnos[run_cnt] = inode->bno[bcnt];
+        run_cnt++;
+    }
+    if (run_cnt == 0)
+    {
+        return;
+    }
+
+    NEWFS_INODE_UNLOCK(inode);
+    for (r = 0; r < run_cnt; r++)
+    {
+        runs[r] = (uint8_t *)malloc(NEWFS_BLKS_SZ(lens[r]));
+        if (newfs_driver_read(NEWFS_DATA_OFS(bnos[r]), runs[r], NEWFS_BLKS_SZ(lens[r])) != NEWFS_ERROR_NONE)
+        { /* 预读失败不报错，之后由newfs_load_block逐块重试 */
+            free(runs[r]);
+            runs[r] = NULL;
+        }
+    }
+    NEWFS_INODE_WRLOCK(inode);
+
+    for (r = 0; r < run_cnt; r++)
+    {
+        charged = 0;
+        for (i = 0; runs[r] && i < lens[r]; i++)
+        {
+            bcnt = starts[r] + i;
+            if ((inode->block_flag[bcnt] & NEWFS_FLAG_BUF_OCCUPY) || inode->bno[bcnt] != bnos[r] + i)
+            {
+                continue;
+            }
+            inode->data_block_pointer[bcnt] = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+            memcpy(inode->data_block_pointer[bcnt], runs[r] + NEWFS_BLKS_SZ(i), NEWFS_BLOCK_SZ());
+            inode->block_flag[bcnt] |= NEWFS_FLAG_BUF_OCCUPY;
+            charged++;
+        }
+        newfs_cache_charge(NEWFS_BLKS_SZ(charged));
+        free(runs[r]);
+    }
+}
+/**
+ * @brief 按本次读更新打开文件的预读状态
+ *
+ * @param file
+ * @param offset
+ * @param size
+ * @param is_miss 未命中缓存：顺序读时窗口翻倍直到NEWFS_RA_MAX，随机读时归零；命中时只记录读到的位置
+ * @return int 本次的预读窗口（块）
+ */
+int newfs_ra_update(struct newfs_file *file, int offset, int size, boolean is_miss)
+{
+    int window;
+
+    pthread_mutex_lock(&file->ra_lock);
+    if (is_miss)
+    {
+        if (offset == file->next_offset)
+        {
+            file->ra_window = file->ra_window ? file->ra_window * 2 : 1;
+            file->ra_window = file->ra_window < NEWFS_RA_MAX ? file->ra_window : NEWFS_RA_MAX;
+        }
+        else
+        {
+            file->ra_window = 0;
+        }
+    }
+    file->next_offset = offset + size;
+    window = file->ra_window;
+    pthread_mutex_unlock(&file->ra_lock);
+    return window;
+}
+/**
+ * @brief 顺序预读：在newfs_read_data之前调用，把本次要读的块连同预读窗口一次读入
+ *
+ * 本次读从上一次读结束处开始视为顺序读，窗口翻倍直到NEWFS_RA_MAX；否则为随机读，
+ * 窗口归零，只合并读本次请求覆盖的块。流式读因此每个窗口只产生一次设备请求。
+ *
+ * 调用者持有inode写锁，但设备读期间会暂时放开（见newfs_prefetch_blocks），
+ * 同一文件上命中缓存的读不必等待预读完成。单个文件至多NEWFS_DATA_PER_FILE块，
+ * NEWFS_RA_MAX取同值，窗口两次翻倍后即覆盖整个文件，不另设后台预读线程
+ *
+ * @param inode 普通文件inode
+ * @param file 打开文件的预读状态，为NULL时只合并本次请求
+ * @param offset
+ * @param size
+ */
+void newfs_readahead(struct newfs_inode *inode, struct newfs_file *file, int offset, int size)
+{
+    int first, last, end;
+
+    if (offset >= inode->size || size <= 0)
+    {
+        return;
+    }
+    size = size < inode->size - offset ? size : inode->size - offset;
+    first = offset / NEWFS_BLOCK_SZ();
+    last = (offset + size - 1) / NEWFS_BLOCK_SZ() + 1;
+    end = last;
+    if (file)
+    {
+        end = last + newfs_ra_update(file, offset, size, TRUE);
+    }
+    /* 不越过文件尾 */
+    last = NEWFS_ROUND_UP(inode->size, NEWFS_BLOCK_SZ()) / NEWFS_BLOCK_SZ();
+    last = last < NEWFS_DATA_PER_FILE ? last : NEWFS_DATA_PER_FILE;
+    newfs_prefetch_blocks(inode, first, (end < last ? end : last) - first);
+}
+/**
+ * @brief 将inode挂入脏链表，等待回写
+ *
+ * @param inode
+ */
+void newfs_mark_dirty(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_super.dirty_lock);
+    if (inode->is_dirty)
+    {
+        pthread_mutex_unlock(&newfs_super.dirty_lock);
+        return;
+    }
+    inode->is_dirty = TRUE;
+    inode->dirty_prev = NULL;
+    inode->dirty_next = newfs_super.dirty_inodes;
+    if (newfs_super.dirty_inodes)
+    {
+        newfs_super.dirty_inodes->dirty_prev = inode;
+    }
+    newfs_super.dirty_inodes = inode;
+    if (++newfs_super.dirty_cnt == NEWFS_JOURNAL_BATCH)
+    { /* 积累够一批就提前提交，不必等到回写周期 */
+        pthread_cond_signal(&newfs_super.writeback_cond);
+    }
+    pthread_mutex_unlock(&newfs_super.dirty_lock);
+}
+/**
+ * @brief 将inode从脏链表摘下
+ *
+ * @param inode
+ */
+static void newfs_clear_dirty(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_super.dirty_lock);
+    if (!inode->is_dirty)
+    {
+        pthread_mutex_unlock(&newfs_super.dirty_lock);
+        return;
+    }
+    if (inode->dirty_prev)
+    {
+        inode->dirty_prev->dirty_next = inode->dirty_next;
+    }
+    else
+    {
+        newfs_super.dirty_inodes = inode->dirty_next;
+    }
+    if (inode->dirty_next)
+    {
+        inode->dirty_next->dirty_prev = inode->dirty_prev;
+    }
+    inode->is_dirty = FALSE;
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    newfs_super.dirty_cnt--;
+    pthread_mutex_unlock(&newfs_super.dirty_lock);
+}
+/**
+ * @brief 从dentrys[from]起尽量多地把目录项打包进一个目录块
+ *
+ * @param block 输出，NEWFS_BLOCK_SZ()字节
+ * @param dentrys 按磁盘顺序排列的目录项
+ * @param from 起始下标
+ * @param cnt dentrys总数
+ * @return int 下一个未打包目录项的下标
+ */
+static int newfs_pack_dentrys(uint8_t *block, struct newfs_dentry **dentrys, int from, int cnt)
+{
+    struct newfs_dentry_d *dentry_d = NULL;
+    int offset = 0, name_len, rec_len;
+
+    memset(block, 0, NEWFS_BLOCK_SZ());
+    while (from < cnt)
+    {
+        name_len = strnlen(dentrys[from]->fname, NEWFS_MAX_FILE_NAME);
+        rec_len = NEWFS_DENTRY_REC_LEN(name_len);
+        if (offset + rec_len > NEWFS_BLOCK_SZ())
+        {
+            break;
+        }
+        dentry_d = (struct newfs_dentry_d *)(block + offset);
+        dentry_d->ino = dentrys[from]->ino;
+        dentry_d->rec_len = rec_len;
+        dentry_d->name_len = name_len;
+        dentry_d->ftype = dentrys[from]->ftype;
+        memcpy(dentry_d->fname, dentrys[from]->fname, name_len);
+        offset += rec_len;
+        from++;
+    }
+    if (dentry_d)
+    {
+        dentry_d->rec_len += NEWFS_BLOCK_SZ() - offset; /* 最后一条记录吞掉块尾空闲 */
+    }
+    else
+    {
+        dentry_d = (struct newfs_dentry_d *)block;
+        dentry_d->rec_len = NEWFS_BLOCK_SZ();
+    }
+    return from;
+}
+/**
+ * @brief 检查块内offset处的磁盘目录项，rec_len与name_len都来自磁盘，不可信
+ *
+ * 记录须4字节对齐、不越出块尾、容得下名字，名字不超过NEWFS_MAX_FILE_NAME
+ *
+ * @param dentry_d 目录项
+ * @param offset 在块内的偏移
+ * @return boolean
+ */
+boolean newfs_dentry_d_valid(struct newfs_dentry_d *dentry_d, int offset)
+{
+    return dentry_d->rec_len >= sizeof(struct newfs_dentry_d) && dentry_d->rec_len % 4 == 0 &&
+           offset + dentry_d->rec_len <= NEWFS_BLOCK_SZ() && dentry_d->name_len <= NEWFS_MAX_FILE_NAME &&
+           sizeof(struct newfs_dentry_d) + dentry_d->name_len <= dentry_d->rec_len;
+}
+/**
+ * @brief 解析一个目录块，把其中的目录项挂到inode下
+ *
+ * @param inode 目录inode
+ * @param block 目录块内容
+ * @param max 最多解析的目录项数
+ * @return int 解析出的目录项数，块内有非法记录时返回-NEWFS_ERROR_IO
+ */
+static int newfs_parse_dentrys(struct newfs_inode *inode, uint8_t *block, int max)
+{
+    struct newfs_dentry_d *dentry_d;
+    struct newfs_dentry *sub_dentry;
+    char fname[NEWFS_MAX_FILE_NAME + 1];
+    int offset = 0, cnt = 0;
+
+    while (cnt < max && offset + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLOCK_SZ())
+    {
+        dentry_d = (struct newfs_dentry_d *)(block + offset);
+        if (!newfs_dentry_d_valid(dentry_d, offset))
+        {
+            NEWFS_DBG("[%s] bad dentry at %d\n", __func__, offset);
+            return -NEWFS_ERROR_IO;
+        }
+        if (dentry_d->name_len > 0)
+        {
+            memcpy(fname, dentry_d->fname, dentry_d->name_len);
+            fname[dentry_d->name_len] = '\0';
+            sub_dentry = newfs_new_dentry(inode, fname, dentry_d->ftype);
+            sub_dentry->parent = inode->dentry;
+            sub_dentry->ino = dentry_d->ino;
+            newfs_alloc_dentry(inode, sub_dentry);
+            cnt++;
+        }
+        offset += dentry_d->rec_len;
+    }
+    return cnt;
+}
+static int newfs_cmp_dentry_hash(const void *a, const void *b)
+{
+    uint32_t hash_a = newfs_name_hash((*(struct newfs_dentry **)a)->fname);
+    uint32_t hash_b = newfs_name_hash((*(struct newfs_dentry **)b)->fname);
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+static int newfs_dx_read(int bno, void *block)
+{
+    if (newfs_driver_read(NEWFS_DATA_OFS(bno), (uint8_t *)block, NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+static int newfs_dx_write(int bno, void *block)
+{
+    if (newfs_journal_write(NEWFS_DATA_OFS(bno), (uint8_t *)block, NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 在索引节点中二分查找覆盖hash的项
+ *
+ * @param node
+ * @param hash
+ * @return int 最后一个hash不大于给定hash的项
+ */
+static int newfs_dx_search(struct newfs_dx_node *node, uint32_t hash)
+{
+    int lo = 1, hi = node->count - 1, mid, pos = 0;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        if (node->entries[mid].hash <= hash)
+        {
+            pos = mid;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return pos;
+}
+static void newfs_dx_insert(struct newfs_dx_node *node, int pos, uint32_t hash, int bno)
+{
+    memmove(&node->entries[pos + 1], &node->entries[pos],
+            (node->count - pos) * sizeof(struct newfs_dx_entry));
+    node->entries[pos].hash = hash;
+    node->entries[pos].bno = bno;
+    node->count++;
+}
+/**
+ * @brief 把满的索引节点后一半移入new_node
+ *
+ * @return uint32_t new_node覆盖的起始hash
+ */
+static uint32_t newfs_dx_split(struct newfs_dx_node *node, struct newfs_dx_node *new_node)
+{
+    int half = node->count / 2;
+
+    memset(new_node, 0, NEWFS_BLOCK_SZ());
+    new_node->count = node->count - half;
+    memcpy(new_node->entries, &node->entries[half], new_node->count * sizeof(struct newfs_dx_entry));
+    node->count = half;
+    return new_node->entries[0].hash;
+}
+/**
+ * @brief 在叶块的空闲空间中放入一个目录项
+ *
+ * @param leaf 叶块内容
+ * @param dentry
+ * @return boolean 叶块剩余空间不足时返回FALSE
+ */
+static boolean newfs_leaf_add(uint8_t *leaf, struct newfs_dentry *dentry)
+{
+    struct newfs_dentry_d *dentry_d, *new_d;
+    int name_len = strnlen(dentry->fname, NEWFS_MAX_FILE_NAME);
+    int need = NEWFS_DENTRY_REC_LEN(name_len);
+    int offset = 0, used;
+
+    while (offset + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLOCK_SZ())
+    {
+        dentry_d = (struct newfs_dentry_d *)(leaf + offset);
+        if (!newfs_dentry_d_valid(dentry_d, offset))
+        { /* 交给newfs_leaf_split报错 */
+            break;
+        }
+        used = dentry_d->name_len ? NEWFS_DENTRY_REC_LEN(dentry_d->name_len) : 0;
+        if (dentry_d->rec_len - used >= need)
+        {
+            new_d = (struct newfs_dentry_d *)(leaf + offset + used);
+            if (used)
+            { /* 从该记录的尾部空闲中切出新记录 */
+                new_d->rec_len = dentry_d->rec_len - used;
+                dentry_d->rec_len = used;
+            }
+            new_d->ino = dentry->ino;
+            new_d->name_len = name_len;
+            new_d->ftype = dentry->ftype;
+            memcpy(new_d->fname, dentry->fname, name_len);
+            return TRUE;
+        }
+        offset += dentry_d->rec_len;
+    }
+    return FALSE;
+}
+/**
+ * @brief 满的叶块按hash对半拆分，dentry随之放入所属的一半
+ *
+ * 同hash的目录项不会被拆到两个叶块，查找时只需读一个叶块
+ *
+ * @param leaf 原叶块，保留hash较小的一半；失败时不变
+ * @param new_leaf 输出hash较大的一半
+ * @param dentry 待插入的目录项
+ * @param split_hash 输出new_leaf覆盖的起始hash
+ * @return int
+ */
+static int newfs_leaf_split(uint8_t *leaf, uint8_t *new_leaf, struct newfs_dentry *dentry,
+                            uint32_t *split_hash)
+{
+    int max = NEWFS_BLOCK_SZ() / sizeof(struct newfs_dentry_d) + 1;
+    struct newfs_dentry *records = (struct newfs_dentry *)malloc(max * sizeof(struct newfs_dentry));
+    char(*names)[NEWFS_MAX_FILE_NAME + 1] = malloc(max * sizeof(*names));
+    struct newfs_dentry **sorted = (struct newfs_dentry **)malloc(max * sizeof(struct newfs_dentry *));
+    uint8_t *low = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+    struct newfs_dentry_d *dentry_d;
+    int cnt = 0, offset = 0, mid, ret = NEWFS_ERROR_NONE;
+
+    while (offset + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLOCK_SZ())
+    {
+        dentry_d = (struct newfs_dentry_d *)(leaf + offset);
+        if (!newfs_dentry_d_valid(dentry_d, offset))
+        {
+            ret = -NEWFS_ERROR_IO;
+            goto out;
+        }
+        if (dentry_d->name_len > 0)
+        {
+            records[cnt].fname = names[cnt];
+            memcpy(records[cnt].fname, dentry_d->fname, dentry_d->name_len);
+            records[cnt].fname[dentry_d->name_len] = '\0';
+            records[cnt].ino = dentry_d->ino;
+            records[cnt].ftype = dentry_d->ftype;
+            sorted[cnt] = &records[cnt];
+            cnt++;
+        }
+        offset += dentry_d->rec_len;
+    }
+    sorted[cnt++] = dentry;
+    qsort(sorted, cnt, sizeof(struct newfs_dentry *), newfs_cmp_dentry_hash);
+
+    for (mid = cnt / 2; mid < cnt && newfs_name_hash(sorted[mid]->fname) == newfs_name_hash(sorted[mid - 1]->fname); mid++)
+        ;
+    if (mid == cnt)
+    {
+        for (mid = cnt / 2; mid > 0 && newfs_name_hash(sorted[mid]->fname) == newfs_name_hash(sorted[mid - 1]->fname); mid--)
+            ;
+    }
+    if (mid == 0 || newfs_pack_dentrys(low, sorted, 0, mid) != mid ||
+        newfs_pack_dentrys(new_leaf, sorted, mid, cnt) != cnt)
+    {
+        NEWFS_DBG("[%s] cannot split leaf\n", __func__);
+        ret = -NEWFS_ERROR_NOSPACE;
+    }
+    else
+    { /* 两半都排好才改动原叶块 */
+        memcpy(leaf, low, NEWFS_BLOCK_SZ());
+        *split_hash = newfs_name_hash(sorted[mid]->fname);
+    }
+out:
+    free(low);
+    free(sorted);
+    free(names);
+    free(records);
+    return ret;
+}
+/**
+ * @brief 取暂存的索引块，不在其中时读入（新分配的块不读，清零）
+ *
+ * 目录项按hash顺序插入，最近取过的块最可能再用，从后往前找
+ *
+ * @param stage
+ * @param bno
+ * @param is_new 本次新分配的块
+ * @return uint8_t* 读盘失败返回NULL
+ */
+static uint8_t *newfs_dx_stage_get(struct newfs_dx_stage *stage, int bno, boolean is_new)
+{
+    uint8_t *block;
+    int i;
+
+    for (i = stage->cnt - 1; i >= 0; i--)
+    {
+        if (stage->bnos[i] == bno)
+        {
+            return stage->blocks[i];
+        }
+    }
+    block = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+    if (is_new)
+    {
+        memset(block, 0, NEWFS_BLOCK_SZ());
+    }
+    else if (newfs_dx_read(bno, block) != NEWFS_ERROR_NONE)
+    {
+        free(block);
+        return NULL;
+    }
+    if (stage->cnt == stage->max)
+    {
+        stage->max = stage->max ? stage->max * 2 : 8;
+        stage->bnos = (int *)realloc(stage->bnos, stage->max * sizeof(int));
+        stage->blocks = (uint8_t **)realloc(stage->blocks, stage->max * sizeof(uint8_t *));
+        stage->is_new = (boolean *)realloc(stage->is_new, stage->max * sizeof(boolean));
+    }
+    stage->bnos[stage->cnt] = bno;
+    stage->blocks[stage->cnt] = block;
+    stage->is_new[stage->cnt] = is_new;
+    stage->cnt++;
+    return block;
+}
+/**
+ * @brief 为索引分配一个新块并放入暂存
+ *
+ * @param stage
+ * @param goal
+ * @param block 输出新块的内容，已清零
+ * @return int 块号，无空闲块时返回-NEWFS_ERROR_NOSPACE
+ */
+static int newfs_dx_stage_alloc(struct newfs_dx_stage *stage, int goal, uint8_t **block)
+{
+    int bno = newfs_alloc_bno(goal);
+
+    if (bno >= 0)
+    {
+        *block = newfs_dx_stage_get(stage, bno, TRUE);
+    }
+    return bno;
+}
+/**
+ * @brief 结束一次插入：成功时把暂存的块全部写入日志，失败时丢弃改动并归还新分配的块
+ *
+ * 新块从未写入日志、也未被任何节点引用，可以不经检查点直接清除位图
+ *
+ * @param stage
+ * @param ret 插入的结果
+ * @return int
+ */
+static int newfs_dx_stage_end(struct newfs_dx_stage *stage, int ret)
+{
+    int i;
+
+    for (i = 0; i < stage->cnt; i++)
+    {
+        if (ret == NEWFS_ERROR_NONE)
+        {
+            ret = newfs_dx_write(stage->bnos[i], stage->blocks[i]);
+        }
+        else if (stage->is_new[i])
+        {
+            newfs_release_bno(stage->bnos[i]);
+        }
+        free(stage->blocks[i]);
+    }
+    free(stage->bnos);
+    free(stage->blocks);
+    free(stage->is_new);
+    return ret;
+}
+/**
+ * @brief 把目录项逐个插入索引目录：按hash定位叶块，叶块满则对半拆分并在父节点登记，
+ * 父节点满则拆分父节点，根满时增加一层中间节点
+ *
+ * 目录项先按hash排序，相邻目录项多落在同一叶块。改动过的块都暂存在内存，
+ * 全部插入成功后才写入日志；中途失败则索引保持原样，新分配的块归还，调用者可整批重试
+ *
+ * @param inode 索引目录
+ * @param dentrys 待插入的目录项，会被重新排序
+ * @param cnt
+ * @return int
+ */
+static int newfs_dx_add_dentrys(struct newfs_inode *inode, struct newfs_dentry **dentrys, int cnt)
+{
+    struct newfs_dx_stage stage;
+    struct newfs_dx_node *root, *node = NULL, *parent, *split, *low, *target;
+    uint8_t *leaf = NULL, *new_leaf, *block;
+    int node_bno = NEWFS_INVALID_BNO, leaf_bno = NEWFS_INVALID_BNO;
+    int ret = NEWFS_ERROR_NONE, i, ri, pi, new_bno, sep_bno, low_bno;
+    uint32_t hash, split_hash, sep_hash;
+
+    if (cnt == 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    memset(&stage, 0, sizeof(struct newfs_dx_stage));
+    qsort(dentrys, cnt, sizeof(struct newfs_dentry *), newfs_cmp_dentry_hash);
+
+    root = (struct newfs_dx_node *)newfs_dx_stage_get(&stage, inode->bno[0], FALSE);
+    if (root == NULL)
+    {
+        ret = -NEWFS_ERROR_IO;
+    }
+    for (i = 0; i < cnt && ret == NEWFS_ERROR_NONE; i++)
+    {
+        hash = newfs_name_hash(dentrys[i]->fname);
+        ri = newfs_dx_search(root, hash);
+        parent = root;
+        pi = ri;
+        if (root->levels > 0)
+        {
+            if (root->entries[ri].bno != node_bno)
+            {
+                node_bno = root->entries[ri].bno;
+                if ((node = (struct newfs_dx_node *)newfs_dx_stage_get(&stage, node_bno, FALSE)) == NULL)
+                {
+                    ret = -NEWFS_ERROR_IO;
+                    break;
+                }
+            }
+            parent = node;
+            pi = newfs_dx_search(node, hash);
+        }
+        if (parent->entries[pi].bno != leaf_bno)
+        {
+            leaf_bno = parent->entries[pi].bno;
+            if ((leaf = newfs_dx_stage_get(&stage, leaf_bno, FALSE)) == NULL)
+            {
+                ret = -NEWFS_ERROR_IO;
+                break;
+            }
+        }
+        if (newfs_leaf_add(leaf, dentrys[i]))
+        {
+            continue;
+        }
+
+        /* 叶块已满：拆出新叶块并在父节点登记 */
+        if (parent->count == NEWFS_DX_LIMIT() && root->levels == NEWFS_DX_MAX_LEVELS - 1 &&
+            root->count == NEWFS_DX_LIMIT())
+        {
+            NEWFS_DBG("[%s] index of ino %d is full\n", __func__, inode->ino);
+            ret = -NEWFS_ERROR_NOSPACE;
+            break;
+        }
+        if ((ret = new_bno = newfs_dx_stage_alloc(&stage, inode->bno[0], &new_leaf)) < 0 ||
+            (ret = newfs_leaf_split(leaf, new_leaf, dentrys[i], &split_hash)) != NEWFS_ERROR_NONE)
+        {
+            break;
+        }
+        if (parent->count < NEWFS_DX_LIMIT())
+        {
+            newfs_dx_insert(parent, pi + 1, split_hash, new_bno);
+            continue;
+        }
+
+        /* 父节点也满：对半拆分父节点 */
+        if ((ret = sep_bno = newfs_dx_stage_alloc(&stage, inode->bno[0], &block)) < 0)
+        {
+            break;
+        }
+        split = (struct newfs_dx_node *)block;
+        if (parent == root)
+        { /* 根下直接是叶块：根的项分给两个新中间节点，根改为指向它们 */
+            if ((ret = low_bno = newfs_dx_stage_alloc(&stage, inode->bno[0], &block)) < 0)
+            {
+                break;
+            }
+            low = (struct newfs_dx_node *)block;
+            sep_hash = newfs_dx_split(root, split);
+            memcpy(low, root, NEWFS_BLOCK_SZ());
+            low->levels = 0;
+            target = split_hash >= sep_hash ? split : low;
+            newfs_dx_insert(target, newfs_dx_search(target, split_hash) + 1, split_hash, new_bno);
+            root->levels = 1;
+            root->count = 2;
+            root->entries[0].hash = 0;
+            root->entries[0].bno = low_bno;
+            root->entries[1].hash = sep_hash;
+            root->entries[1].bno = sep_bno;
+            node = low;
+            node_bno = low_bno;
+        }
+        else
+        {
+            sep_hash = newfs_dx_split(node, split);
+            target = split_hash >= sep_hash ? split : node;
+            newfs_dx_insert(target, newfs_dx_search(target, split_hash) + 1, split_hash, new_bno);
+            newfs_dx_insert(root, ri + 1, sep_hash, sep_bno);
+        }
+        ret = NEWFS_ERROR_NONE;
+    }
+    return newfs_dx_stage_end(&stage, ret);
+}
+/**
+ * @brief 目录超过一块时转为索引目录：bno[0]改作索引根，其余目录块归还，再插入全部目录项
+ *
+ * @param inode 线性目录，目录项已全部在内存
+ * @param dentrys 全部目录项
+ * @param cnt
+ * @return int
+ */
+static int newfs_dx_build(struct newfs_inode *inode, struct newfs_dentry **dentrys, int cnt)
+{
+    struct newfs_dx_node *root;
+    uint8_t *leaf;
+    int bcnt, leaf_bno, ret;
+
+    for (bcnt = 1; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+    {
+        if (inode->bno[bcnt] != NEWFS_INVALID_BNO)
+        {
+            newfs_free_bno(inode->bno[bcnt]);
+            inode->bno[bcnt] = NEWFS_INVALID_BNO;
+        }
+    }
+    if (inode->bno[0] == NEWFS_INVALID_BNO &&
+        (ret = newfs_find_free_block(inode, 0)) != NEWFS_ERROR_NONE)
+    {
+        return ret;
+    }
+    if ((leaf_bno = newfs_alloc_bno(inode->bno[0])) < 0)
+    {
+        return leaf_bno;
+    }
+
+    leaf = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+    newfs_pack_dentrys(leaf, dentrys, 0, 0); /* 空叶块 */
+    root = (struct newfs_dx_node *)leaf;
+    ret = newfs_dx_write(leaf_bno, leaf);
+    if (ret == NEWFS_ERROR_NONE)
+    {
+        memset(root, 0, NEWFS_BLOCK_SZ());
+        root->count = 1;
+        root->levels = 0;
+        root->entries[0].hash = 0;
+        root->entries[0].bno = leaf_bno;
+        ret = newfs_dx_write(inode->bno[0], root);
+    }
+    free(leaf);
+    if (ret != NEWFS_ERROR_NONE)
+    {
+        return ret;
+    }
+    inode->is_indexed = TRUE;
+    if ((ret = newfs_dx_add_dentrys(inode, dentrys, cnt)) != NEWFS_ERROR_NONE)
+    { /* 索引已建成但为空，下次回写重新插入全部目录项 */
+        inode->dirty_from = 0;
+    }
+    return ret;
+}
+/**
+ * @brief 文件是否以inline形式存放：足够小且从未分配过数据块
+ *
+ * @param inode
+ * @return boolean
+ */
+static boolean newfs_is_inline(struct newfs_inode *inode)
+{
+    int bcnt;
+    if (inode->size > NEWFS_INLINE_DATA_SZ)
+    {
+        return FALSE;
+    }
+    for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+    {
+        if (inode->bno[bcnt] != NEWFS_INVALID_BNO)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+/**
+ * @brief 将内存inode及其目录项/数据刷回磁盘，不递归子inode（子inode若有修改自会在脏链表中）
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_sync_inode(struct newfs_inode *inode)
+{
+    struct newfs_inode_d inode_d;
+    struct newfs_dentry **dentrys;
+    uint8_t *block;
+    int ino = inode->ino;
+    int bcnt, i, next, cnt, ret;
+
+    memset(&inode_d, 0, sizeof(struct newfs_inode_d));
+    inode_d.ino = ino;
+    inode_d.size = inode->size;
+    inode_d.ftype = inode->dentry->ftype;
+    inode_d.dir_cnt = inode->dir_cnt;
+    inode_d.atime = inode->atime;
+    inode_d.mtime = inode->mtime;
+    inode_d.ctime = inode->ctime;
+
+    /* Cycle 1: 写 数据，只写有变化的块，块号仅在首次落盘时分配 */
+    if (NEWFS_IS_DIR(inode) && inode->is_indexed)
+    {
+        /* 只有自上次回写后新建的目录项（位于数组末尾）需要插入索引；插入时会按hash排序，用副本 */
+        cnt = inode->dir_cnt - inode->dirty_from;
+        dentrys = (struct newfs_dentry **)malloc((cnt + 1) * sizeof(struct newfs_dentry *));
+        memcpy(dentrys, inode->dentrys + inode->dentry_cnt - cnt, cnt * sizeof(struct newfs_dentry *));
+        ret = newfs_dx_add_dentrys(inode, dentrys, cnt);
+        free(dentrys);
+        if (ret != NEWFS_ERROR_NONE)
+        {
+            return ret;
+        }
+        inode->dirty_from = inode->dir_cnt;
+    }
+    else if (NEWFS_IS_DIR(inode))
+    {
+        /* dentrys按创建顺序排列即是磁盘顺序，新增目录项只会改动末尾的块；转为索引时会被排序，用副本 */
+        dentrys = (struct newfs_dentry **)malloc((inode->dir_cnt + 1) * sizeof(struct newfs_dentry *));
+        memcpy(dentrys, inode->dentrys, inode->dir_cnt * sizeof(struct newfs_dentry *));
+        if (inode->size > NEWFS_BLOCK_SZ())
+        { /* 目录超过一块，转为索引目录 */
+            ret = newfs_dx_build(inode, dentrys, inode->dir_cnt);
+            free(dentrys);
+            if (ret != NEWFS_ERROR_NONE)
+            {
+                return ret;
+            }
+            inode->dirty_from = inode->dir_cnt;
+            goto write_inode;
+        }
+        block = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+        /* 排布在内存中从头计算，早于dirty_from所在块的内容不变，无需重写 */
+        for (bcnt = 0, i = 0; i < inode->dir_cnt && bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+        {
+            next = newfs_pack_dentrys(block, dentrys, i, inode->dir_cnt);
+            if (next <= inode->dirty_from)
+            {
+                i = next;
+                continue;
+            }
+            if (inode->bno[bcnt] == NEWFS_INVALID_BNO &&
+                newfs_find_free_block(inode, bcnt) != NEWFS_ERROR_NONE)
+            {
+                free(block);
+                free(dentrys);
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            if (newfs_journal_write(NEWFS_DATA_OFS(inode->bno[bcnt]), block,
+                                    NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+            {
+                NEWFS_DBG("[%s] io error\n", __func__);
+                free(block);
+                free(dentrys);
+                return -NEWFS_ERROR_IO;
+            }
+            i = next;
+        }
+        if (i < inode->dir_cnt)
+        {
+            NEWFS_DBG("[%s] too many dentrys in ino %d\n", __func__, ino);
+        }
+        inode->dirty_from = inode->dir_cnt;
+        free(block);
+        free(dentrys);
+    }
+    else if (NEWFS_IS_REG(inode) && newfs_is_inline(inode))
+    {
+        /* 小文件内容直接写进inode，不占数据块 */
+        inode_d.flags |= NEWFS_INODE_FLAG_INLINE;
+        if (inode->size > 0)
+        {
+            block = newfs_load_block(inode, 0);
+            if (block == NULL)
+            {
+                return -NEWFS_ERROR_IO;
+            }
+            memcpy(inode_d.inline_data, block, inode->size);
+        }
+        inode->block_flag[0] &= ~NEWFS_FLAG_BUF_DIRTY;
+    }
+    else if (NEWFS_IS_REG(inode))
+    {
+        /* 由inline转为块存储时，已缓存但从未落到数据块的内容也在这里分配并标脏 */
+        if (newfs_alloc_file_blocks(inode) != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt = next)
+        {
+            next = bcnt + 1;
+            if (!(inode->block_flag[bcnt] & NEWFS_FLAG_BUF_DIRTY))
+            {
+                continue;
+            }
+            if (inode->bno[bcnt] == NEWFS_INVALID_BNO)
+            { /* 超出文件大小的脏块（已被截断），不再落盘 */
+                inode->block_flag[bcnt] &= ~NEWFS_FLAG_BUF_DIRTY;
+                continue;
+            }
+            /* 块号连续的脏块合并为一次写 */
+            while (next < NEWFS_DATA_PER_FILE && (inode->block_flag[next] & NEWFS_FLAG_BUF_DIRTY) &&
+                   inode->bno[next] == inode->bno[next - 1] + 1 &&
+                   NEWFS_BNO_GROUP(inode->bno[next]) == NEWFS_BNO_GROUP(inode->bno[bcnt]))
+            {
+                next++;
+            }
+            block = inode->data_block_pointer[bcnt];
+            if (next - bcnt > 1)
+            {
+                block = (uint8_t *)malloc(NEWFS_BLKS_SZ((next - bcnt)));
+                for (i = bcnt; i < next; i++)
+                {
+                    memcpy(block + NEWFS_BLKS_SZ((i - bcnt)), inode->data_block_pointer[i], NEWFS_BLOCK_SZ());
+                }
+            }
+            ret = newfs_driver_write(NEWFS_DATA_OFS(inode->bno[bcnt]), block, NEWFS_BLKS_SZ((next - bcnt)));
+            if (block != inode->data_block_pointer[bcnt])
+            {
+                free(block);
+            }
+            if (ret != NEWFS_ERROR_NONE)
+            {
+                NEWFS_DBG("[%s] io error\n", __func__);
+                return -NEWFS_ERROR_IO;
+            }
+            for (i = bcnt; i < next; i++)
+            {
+                inode->block_flag[i] &= ~NEWFS_FLAG_BUF_DIRTY;
+            }
+        }
+    }
+    else if (NEWFS_IS_SYM_LINK(inode) && strlen(inode->target_path) < NEWFS_INLINE_DATA_SZ)
+    {
+        inode_d.flags |= NEWFS_INODE_FLAG_INLINE;
+        strcpy((char *)inode_d.inline_data, inode->target_path);
+    }
+    else if (NEWFS_IS_SYM_LINK(inode))
+    {
+        /* 较长的目标路径不占inode空间，写到bno[0]数据块 */
+        if (inode->bno[0] == NEWFS_INVALID_BNO &&
+            newfs_find_free_block(inode, 0) != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        if (newfs_journal_write(NEWFS_DATA_OFS(inode->bno[0]), (uint8_t *)inode->target_path,
+                                NEWFS_MAX_FILE_NAME) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+
+write_inode:
+    /* Cycle 2: 写 INODE */
+    if (inode->is_indexed)
+    {
+        inode_d.flags |= NEWFS_INODE_FLAG_INDEX;
+    }
+    for (bcnt = 0; !(inode_d.flags & NEWFS_INODE_FLAG_INLINE) && bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+    {
+        inode_d.bno[bcnt] = inode->bno[bcnt];
+    }
+    if (newfs_journal_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d,
+                            sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+
+    newfs_clear_dirty(inode);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 由内存超级块生成磁盘超级块
+ *
+ * @param newfs_super_d 输出
+ */
+static void newfs_fill_super_d(struct newfs_super_d *newfs_super_d)
+{
+    newfs_super_d->magic_num = NEWFS_MAGIC_NUM;
+    newfs_super_d->version = NEWFS_LAYOUT_VERSION;
+
+    newfs_super_d->map_inode_blks = newfs_super.map_inode_blks;
+    newfs_super_d->map_inode_offset = newfs_super.map_inode_offset;
+    newfs_super_d->inode_offset = newfs_super.inode_offset;
+
+    newfs_super_d->map_data_blks = newfs_super.map_data_blks;
+    newfs_super_d->map_data_offset = newfs_super.map_data_offset;
+    newfs_super_d->data_offset = newfs_super.data_offset;
+
+    newfs_super_d->sz_usage = newfs_super.sz_usage;
+    newfs_super_d->max_ino = newfs_super.max_ino;
+    newfs_super_d->max_data = newfs_super.max_data;
+
+    newfs_super_d->groups_cnt = newfs_super.groups_cnt;
+    newfs_super_d->blks_per_group = newfs_super.blks_per_group;
+    newfs_super_d->inodes_per_group = newfs_super.inodes_per_group;
+    newfs_super_d->data_per_group = newfs_super.data_per_group;
+
+    newfs_super_d->journal_offset = newfs_super.journal.offset;
+    newfs_super_d->journal_blks = newfs_super.journal.blks;
+
+    newfs_super_d->free_ino = newfs_super.free_ino;
+    newfs_super_d->free_data = newfs_super.free_data;
+}
+/**
+ * @brief 回写超级块与有变化的组位图
+ *
+ * @return int
+ */
+static int newfs_sync_super()
+{
+    struct newfs_super_d newfs_super_d;
+    int group;
+
+    newfs_fill_super_d(&newfs_super_d);
+    if (newfs_journal_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d,
+                            sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+
+    for (group = 0; group < newfs_super.groups_cnt; group++)
+    {
+        if (!newfs_super.group_dirty[group])
+        {
+            continue;
+        }
+        if (newfs_journal_write(NEWFS_GROUP_OFS(group) + newfs_super.map_inode_offset,
+                                newfs_super.map_inode + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE ||
+            newfs_journal_write(NEWFS_GROUP_OFS(group) + newfs_super.map_data_offset,
+                                newfs_super.map_data + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_super.group_dirty[group] = FALSE;
+    }
+    newfs_super.is_super_dirty = FALSE;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 回写脏链表中的inode，以及有变化的超级块/位图，调用者需独占持有newfs_super.tree_lock
+ *
+ * 本次回写的全部元数据作为一个日志事务提交，文件数据在提交前已直接写回原位
+ *
+ * @return int
+ */
+int newfs_sync_fs()
+{
+    int ret;
+    while (newfs_super.dirty_inodes)
+    {
+        ret = newfs_sync_inode(newfs_super.dirty_inodes);
+        if (ret != NEWFS_ERROR_NONE)
+        {
+            return ret;
+        }
+    }
+    if (newfs_super.is_super_dirty && (ret = newfs_sync_super()) != NEWFS_ERROR_NONE)
+    {
+        return ret;
+    }
+    return newfs_journal_commit();
+}
+/**
+ * @brief 后台回写线程，每NEWFS_WRITEBACK_INTERVAL秒回写一次
+ *
+ * @param arg 未使用
+ * @return void*
+ */
+static void *newfs_writeback(void *arg)
+{
+    struct timespec deadline;
+    boolean is_stop = FALSE;
+    (void)arg;
+
+    while (!is_stop)
+    {
+        pthread_mutex_lock(&newfs_super.writeback_lock);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += NEWFS_WRITEBACK_INTERVAL;
+        if (!newfs_super.writeback_stop)
+        {
+            pthread_cond_timedwait(&newfs_super.writeback_cond, &newfs_super.writeback_lock, &deadline);
+        }
+        is_stop = newfs_super.writeback_stop;
+        pthread_mutex_unlock(&newfs_super.writeback_lock);
+
+        NEWFS_TREE_WRLOCK(); /* 等正在进行的操作退出，回写期间不再有并发修改 */
+        if (newfs_sync_fs() != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] writeback error\n", __func__);
+        }
+        newfs_cache_shrink(); /* 回写后都是干净的，超出预算的部分可以丢弃 */
+        NEWFS_TREE_UNLOCK();
+    }
+    return NULL;
+}
+/**
+ * @brief 启动后台回写线程
+ *
+ * @return int
+ */
+int newfs_start_writeback()
+{
+    newfs_super.writeback_stop = FALSE;
+    pthread_cond_init(&newfs_super.writeback_cond, NULL);
+    if (pthread_create(&newfs_super.writeback_thread, NULL, newfs_writeback, NULL) != 0)
+    {
+        return -NEWFS_ERROR_INVAL;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 通知回写线程退出（退出前会再回写一次）并等待其结束
+ *
+ */
+void newfs_stop_writeback()
+{
+    pthread_mutex_lock(&newfs_super.writeback_lock);
+    newfs_super.writeback_stop = TRUE;
+    pthread_cond_signal(&newfs_super.writeback_cond);
+    pthread_mutex_unlock(&newfs_super.writeback_lock);
+    pthread_join(newfs_super.writeback_thread, NULL);
+    pthread_cond_destroy(&newfs_super.writeback_cond);
+}
+/**
+ * @brief 读出目录的全部目录项
+ *
+ * 每个目录块只读一次并在内存中一次解析完；块号连续的目录块合并成一次驱动读，
+ * 相当于在解析当前块时下一块已经预读到位
+ *
+ * @param inode 目录inode
+ * @param dir_cnt 磁盘上记录的目录项数
+ * @return int
+ */
+static int newfs_read_dentrys(struct newfs_inode *inode, int dir_cnt)
+{
+    uint8_t *blocks;
+    int blk_cnt = 0;
+    int bcnt, run, cnt;
+
+    while (blk_cnt < NEWFS_DATA_PER_FILE && inode->bno[blk_cnt] != NEWFS_INVALID_BNO)
+    {
+        blk_cnt++;
+    }
+    blocks = (uint8_t *)malloc(NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE));
+    for (bcnt = 0; bcnt < blk_cnt; bcnt += run)
+    {
+        run = 1;
+        while (bcnt + run < blk_cnt && inode->bno[bcnt + run] == inode->bno[bcnt] + run)
+        {
+            run++;
+        }
+        if (newfs_driver_read(NEWFS_DATA_OFS(inode->bno[bcnt]), blocks + NEWFS_BLKS_SZ(bcnt),
+                              NEWFS_BLKS_SZ(run)) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            free(blocks);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+
+    for (bcnt = 0; bcnt < blk_cnt && dir_cnt > 0; bcnt++)
+    {
+        if ((cnt = newfs_parse_dentrys(inode, blocks + NEWFS_BLKS_SZ(bcnt), dir_cnt)) < 0)
+        {
+            free(blocks);
+            return cnt;
+        }
+        dir_cnt -= cnt;
+    }
+    free(blocks);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 把按需读入的目录项放到尚未落盘的新目录项之前，不计入dir_cnt
+ *
+ * @param inode
+ * @param dentry
+ */
+static void newfs_attach_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
+{
+    dentry->parent = inode->dentry;
+    newfs_insert_dentry(inode, dentry, inode->dentry_cnt - (inode->dir_cnt - inode->dirty_from));
+}
+/**
+ * @brief 在索引目录中按名字查找，只读根、中间节点与一个叶块
+ *
+ * @param inode 索引目录
+ * @param fname
+ * @param dentry_out 输出找到的目录项，已挂入dentrys；未找到为NULL
+ * @return int 读盘失败返回-NEWFS_ERROR_IO，与未找到区分开
+ */
+static int newfs_dx_lookup(struct newfs_inode *inode, const char *fname, struct newfs_dentry **dentry_out)
+{
+    struct newfs_dx_node *node = (struct newfs_dx_node *)malloc(NEWFS_BLOCK_SZ());
+    struct newfs_dentry *dentry = NULL;
+    struct newfs_dentry_d *dentry_d;
+    uint32_t hash = newfs_name_hash(fname);
+    int name_len = strlen(fname);
+    int bno = inode->bno[0];
+    int level, levels = 0, offset = 0;
+
+    *dentry_out = NULL;
+    for (level = 0; level <= levels; level++)
+    {
+        if (newfs_dx_read(bno, node) != NEWFS_ERROR_NONE)
+        {
+            free(node);
+            return -NEWFS_ERROR_IO;
+        }
+        if (level == 0)
+        {
+            levels = node->levels;
+        }
+        bno = node->entries[newfs_dx_search(node, hash)].bno;
+    }
+    if (newfs_dx_read(bno, node) != NEWFS_ERROR_NONE)
+    {
+        free(node);
+        return -NEWFS_ERROR_IO;
+    }
+    while (offset + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLOCK_SZ())
+    {
+        dentry_d = (struct newfs_dentry_d *)((uint8_t *)node + offset);
+        if (!newfs_dentry_d_valid(dentry_d, offset))
+        {
+            NEWFS_DBG("[%s] bad dentry in leaf %d\n", __func__, bno);
+            free(node);
+            return -NEWFS_ERROR_IO;
+        }
+        if (dentry_d->name_len == name_len && memcmp(dentry_d->fname, fname, name_len) == 0)
+        {
+            dentry = newfs_new_dentry(inode, fname, dentry_d->ftype);
+            dentry->ino = dentry_d->ino;
+            newfs_attach_dentry(inode, dentry);
+            break;
+        }
+        offset += dentry_d->rec_len;
+    }
+    free(node);
+    *dentry_out = dentry;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 读入一个叶块，补上尚未在内存中的目录项
+ *
+ * @param inode 索引目录
+ * @param bno 叶块号
+ * @param leaf 缓冲区
+ * @param cached_cnt dentrys的前cached_cnt项是查找时已按需读入的
+ * @return int
+ */
+static int newfs_dx_load_leaf(struct newfs_inode *inode, int bno, uint8_t *leaf, int cached_cnt)
+{
+    struct newfs_dentry_d *dentry_d;
+    struct newfs_dentry *dentry_cursor;
+    char fname[NEWFS_MAX_FILE_NAME + 1];
+    uint32_t hash;
+    int offset = 0, i;
+
+    if (newfs_dx_read(bno, leaf) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    while (offset + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLOCK_SZ())
+    {
+        dentry_d = (struct newfs_dentry_d *)(leaf + offset);
+        if (!newfs_dentry_d_valid(dentry_d, offset))
+        {
+            NEWFS_DBG("[%s] bad dentry in leaf %d\n", __func__, bno);
+            return -NEWFS_ERROR_IO;
+        }
+        offset += dentry_d->rec_len;
+        if (dentry_d->name_len == 0)
+        {
+            continue;
+        }
+        memcpy(fname, dentry_d->fname, dentry_d->name_len);
+        fname[dentry_d->name_len] = '\0';
+        hash = newfs_name_hash(fname);
+        for (i = newfs_hash_scan(inode->hashes, 0, cached_cnt, hash); i < cached_cnt;
+             i = newfs_hash_scan(inode->hashes, i + 1, cached_cnt, hash))
+        {
+            if (inode->dentrys[i]->ino == (int)dentry_d->ino)
+            {
+                break;
+            }
+        }
+        if (i < cached_cnt)
+        { /* 查找时已按需读入 */
+            continue;
+        }
+        dentry_cursor = newfs_new_dentry(inode, fname, dentry_d->ftype);
+        dentry_cursor->ino = dentry_d->ino;
+        newfs_attach_dentry(inode, dentry_cursor);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 读出索引目录的全部叶块，使dentrys完整，供readdir使用
+ *
+ * @param inode 索引目录
+ * @return int
+ */
+static int newfs_dx_load_dentrys(struct newfs_inode *inode)
+{
+    struct newfs_dx_node *root = (struct newfs_dx_node *)malloc(NEWFS_BLOCK_SZ());
+    struct newfs_dx_node *node = (struct newfs_dx_node *)malloc(NEWFS_BLOCK_SZ());
+    uint8_t *leaf = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+    int cached_cnt = inode->dentry_cnt - (inode->dir_cnt - inode->dirty_from); /* 尚未落盘的新目录项在末尾，不算 */
+    int i, j;
+    int ret = newfs_dx_read(inode->bno[0], root);
+
+    for (i = 0; i < root->count && ret == NEWFS_ERROR_NONE; i++)
+    {
+        if (root->levels == 0)
+        {
+            ret = newfs_dx_load_leaf(inode, root->entries[i].bno, leaf, cached_cnt);
+            continue;
+        }
+        ret = newfs_dx_read(root->entries[i].bno, node);
+        for (j = 0; j < node->count && ret == NEWFS_ERROR_NONE; j++)
+        {
+            ret = newfs_dx_load_leaf(inode, node->entries[j].bno, leaf, cached_cnt);
+        }
+    }
+    inode->is_complete = ret == NEWFS_ERROR_NONE;
+    free(leaf);
+    free(node);
+    free(root);
+    return ret;
 }
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 根据磁盘inode构建内存inode，目录会继续读出其目录项
  *
- * @param inode
- * @return int
+ * @param dentry dentry指向该inode
+ * @param inode_d 已读出的磁盘inode
+ * @return struct newfs_inode*
  */
-int newfs_sync_inode(struct newfs_inode *inode)
+static struct newfs_inode *newfs_build_inode(struct newfs_dentry *dentry, struct newfs_inode_d *inode_d)
 {
-    struct newfs_inode_d inode_d;
-    struct newfs_dentry *dentry_cursor;
-    struct newfs_dentry_d dentry_d;
-    int ino = inode->ino;
-    inode_d.ino = ino;
-    inode_d.size = inode->size;
-    memcpy(inode_d.target_path, inode->target_path, NEWFS_MAX_FILE_NAME);
-    inode_d.ftype = inode->dentry->ftype;
-    inode_d.dir_cnt = inode->dir_cnt;
+    struct newfs_inode *inode = (struct newfs_inode *)newfs_slab_alloc(&newfs_inode_slab);
+    int bcnt = 0;
 
-    /* Cycle 1: 写 INODE */
-    /* Cycle 2: 写 数据 */
-    int bcnt, offset;
-    if (NEWFS_IS_DIR(inode))
+    pthread_rwlock_init(&inode->lock, NULL);
+    inode->dir_cnt = 0;
+    inode->ino = inode_d->ino;
+    for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
     {
-        dentry_cursor = inode->dentrys;
-        bcnt = 0;
-        while (bcnt < NEWFS_DATA_PER_FILE && dentry_cursor != NULL)
-        {
-            newfs_find_free_block(inode, bcnt);
-            offset = NEWFS_DATA_OFS(inode->bno[bcnt]);
-            while (dentry_cursor != NULL && offset < NEWFS_DATA_OFS((inode->bno[bcnt] + 1)))
-            {
-                memcpy(dentry_d.fname, dentry_cursor->fname, NEWFS_MAX_FILE_NAME);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                if (newfs_driver_write(offset, (uint8_t *)&dentry_d,
-                                       sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE)
-                {
-                    NEWFS_DBG("[%s] io error\n", __func__);
-                    return -NEWFS_ERROR_IO;
-                }
-
-                if (dentry_cursor->inode != NULL)
-                {
-                    newfs_sync_inode(dentry_cursor->inode);
-                }
+        inode->bno[bcnt] = (inode_d->flags & NEWFS_INODE_FLAG_INLINE) ? NEWFS_INVALID_BNO : inode_d->bno[bcnt];
+        inode->data_block_pointer[bcnt] = NULL;
+        inode->block_flag[bcnt] = 0;
+    }
+    inode->size = inode_d->size;
+    inode->atime = inode_d->atime;
+    inode->mtime = inode_d->mtime;
+    inode->ctime = inode_d->ctime;
+    memset(inode->target_path, 0, NEWFS_MAX_FILE_NAME);
+    inode->dentry = dentry;
+    inode->dentrys = NULL;
+    inode->hashes = NULL;
+    inode->dentry_cnt = inode->dentry_cap = 0;
+    inode->unloaded_cnt = 0;
+    inode->is_dirty = FALSE;
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    inode->refcnt = 0;
+    inode->lru_prev = inode->lru_next = NULL;
+    inode->is_indexed = (inode_d->flags & NEWFS_INODE_FLAG_INDEX) != 0;
+    inode->is_complete = TRUE;
 
-                dentry_cursor = dentry_cursor->brother;
-                offset += sizeof(struct newfs_dentry_d);
-            }
-            bcnt++;
-        }
+    if (NEWFS_IS_DIR(inode) && inode->is_indexed)
+    {
+        /* 索引目录不在此读出目录项：查找时按hash读单个叶块，readdir时再整体读入 */
+        inode->dir_cnt = inode_d->dir_cnt;
+        inode->dirty_from = inode->dir_cnt;
+        inode->is_complete = FALSE;
     }
-    else if (NEWFS_IS_REG(inode))
+    else if (NEWFS_IS_DIR(inode))
     {
-        for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+        inode->size = 0; /* 由newfs_alloc_dentry逐项累加 */
+        if (newfs_read_dentrys(inode, inode_d->dir_cnt) != NEWFS_ERROR_NONE)
         {
-            newfs_find_free_block(inode, bcnt);
-            inode->data_block_pointer[bcnt] = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
-            if (newfs_driver_write(NEWFS_DATA_OFS(inode->bno[bcnt]), inode->data_block_pointer[bcnt],
-                                   NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
-            {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return -NEWFS_ERROR_IO;
-            }
-            if (inode->size < (bcnt + 1) * NEWFS_BLOCK_SZ())
-                break;
+            newfs_free_inode(inode);
+            return NULL;
         }
+        inode->dirty_from = inode->dir_cnt;
     }
-
-    for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+    else if (NEWFS_IS_SYM_LINK(inode) && (inode_d->flags & NEWFS_INODE_FLAG_INLINE))
     {
-        inode_d.bno[bcnt] = inode->bno[bcnt];
+        strncpy(inode->target_path, (char *)inode_d->inline_data, NEWFS_INLINE_DATA_SZ - 1);
     }
-    if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d,
-                           sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE)
+    else if (NEWFS_IS_SYM_LINK(inode) && inode->bno[0] != NEWFS_INVALID_BNO)
     {
-        NEWFS_DBG("[%s] io error\n", __func__);
-        return -NEWFS_ERROR_IO;
+        if (newfs_driver_read(NEWFS_DATA_OFS(inode->bno[0]), (uint8_t *)inode->target_path,
+                              NEWFS_MAX_FILE_NAME) != NEWFS_ERROR_NONE)
+        {
+            newfs_free_inode(inode);
+            return NULL;
+        }
     }
-
-    return NEWFS_ERROR_NONE;
+    else if (NEWFS_IS_REG(inode))
+    {
+        /* 只建立元数据，数据块在首次读写时由newfs_load_block按需读入 */
+        if (inode_d->flags & NEWFS_INODE_FLAG_INLINE)
+        { /* inline内容随inode一次读入，直接作为第0块的缓存 */
+            inode->data_block_pointer[0] = (uint8_t *)calloc(1, NEWFS_BLOCK_SZ());
+            memcpy(inode->data_block_pointer[0], inode_d->inline_data, inode->size);
+            inode->block_flag[0] = NEWFS_FLAG_BUF_OCCUPY;
+            newfs_cache_charge(NEWFS_BLOCK_SZ());
+        }
+    }
+    return inode;
 }
 /**
  * @brief
@@ -292,66 +2405,92 @@ int newfs_sync_inode(struct newfs_inode *inode)
  */
 struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino)
 {
-    struct newfs_inode *inode = (struct newfs_inode *)malloc(sizeof(struct newfs_inode));
     struct newfs_inode_d inode_d;
-    struct newfs_dentry *sub_dentry;
-    struct newfs_dentry_d dentry_d;
-    int dir_cnt = 0, bcnt = 0, offset = 0;
     if (newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d,
                           sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE)
     {
         NEWFS_DBG("[%s] io error\n", __func__);
         return NULL;
     }
-    inode->dir_cnt = 0;
-    inode->ino = inode_d.ino;
-    for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
-        inode->bno[bcnt] = inode_d.bno[bcnt];
-    inode->size = inode_d.size;
-    memcpy(inode->target_path, inode_d.target_path, NEWFS_MAX_FILE_NAME);
-    inode->dentry = dentry;
-    inode->dentrys = NULL;
+    return newfs_build_inode(dentry, &inode_d);
+}
+static int newfs_cmp_dentry_ino(const void *a, const void *b)
+{
+    return (*(struct newfs_dentry **)a)->ino - (*(struct newfs_dentry **)b)->ino;
+}
+/**
+ * @brief 一次性读入目录下所有尚未加载的子inode，索引目录先补齐全部目录项
+ *
+ * 子项按ino排序后按inode块归并：同一块内的inode只读一次，相邻的inode块合并为一次驱动读
+ * （每次至多NEWFS_INODE_BATCH块），供readdir在同一趟扫描中填充stat
+ *
+ * @param inode 目录inode
+ * @return int
+ */
+int newfs_read_dir_inodes(struct newfs_inode *inode)
+{
+    struct newfs_dentry **pending;
+    uint8_t *batch;
+    int per_blk = NEWFS_INODE_PER_BLK();
+    int pending_cnt = 0, start, end, first_blk, blk_cnt, i;
+    int ret = NEWFS_ERROR_NONE;
+
+    if (!NEWFS_IS_DIR(inode) || inode->dir_cnt == 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    if (!inode->is_complete && newfs_dx_load_dentrys(inode) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
 
-    if (NEWFS_IS_DIR(inode))
+    pending = (struct newfs_dentry **)malloc(inode->dir_cnt * sizeof(struct newfs_dentry *));
+    for (i = 0; i < inode->dentry_cnt; i++)
     {
-        dir_cnt = inode_d.dir_cnt;
-        bcnt = 0;
-        while (dir_cnt > 0 && bcnt < NEWFS_DATA_PER_FILE)
+        if (inode->dentrys[i]->inode == NULL)
         {
-            offset = NEWFS_DATA_OFS(inode->bno[bcnt]);
-            while (dir_cnt > 0 && offset < NEWFS_DATA_OFS((inode->bno[bcnt] + 1)))
-            {
-                if (newfs_driver_read(offset,
-                                      (uint8_t *)&dentry_d,
-                                      sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE)
-                {
-                    NEWFS_DBG("[%s] io error\n", __func__);
-                    return NULL;
-                }
-                sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-                sub_dentry->parent = inode->dentry;
-                sub_dentry->ino = dentry_d.ino;
-                newfs_alloc_dentry(inode, sub_dentry);
-                offset += sizeof(struct newfs_dentry_d);
-                dir_cnt--;
-            }
-            bcnt++;
+            pending[pending_cnt++] = inode->dentrys[i];
         }
     }
-    else if (NEWFS_IS_REG(inode))
+    qsort(pending, pending_cnt, sizeof(struct newfs_dentry *), newfs_cmp_dentry_ino);
+
+    batch = (uint8_t *)malloc(NEWFS_BLKS_SZ(NEWFS_INODE_BATCH));
+    for (start = 0; start < pending_cnt; start = end)
     {
-        for (bcnt = 0; bcnt < NEWFS_DATA_PER_FILE; bcnt++)
+        first_blk = pending[start]->ino / per_blk;
+        end = start + 1;
+        while (end < pending_cnt && pending[end]->ino / per_blk < first_blk + NEWFS_INODE_BATCH &&
+               NEWFS_INO_GROUP(pending[end]->ino) == NEWFS_INO_GROUP(pending[start]->ino)) /* inode表按组分段 */
         {
-            inode->data_block_pointer[bcnt] = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode->bno[bcnt]), (uint8_t *)inode->data_block_pointer[bcnt],
-                                  NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+            end++;
+        }
+        blk_cnt = pending[end - 1]->ino / per_blk - first_blk + 1;
+        if (newfs_driver_read(NEWFS_INO_OFS(first_blk * per_blk), batch,
+                              NEWFS_BLKS_SZ(blk_cnt)) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            free(batch);
+            free(pending);
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = start; i < end; i++)
+        {
+            pending[i]->inode = newfs_build_inode(pending[i], (struct newfs_inode_d *)(batch +
+                                                  (pending[i]->ino - first_blk * per_blk) * NEWFS_INODE_D_SZ));
+            if (pending[i]->inode)
             {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;
+                newfs_cache_add(pending[i]->inode);
+                inode->unloaded_cnt--;
+            }
+            else
+            { /* 其余的照常建立，但不能让readdir拿着inode为空的目录项去填stat */
+                ret = -NEWFS_ERROR_IO;
             }
         }
     }
-    return inode;
+    free(batch);
+    free(pending);
+    return ret;
 }
 /**
  * @brief
@@ -362,18 +2501,208 @@ struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino)
  */
 struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir)
 {
-    struct newfs_dentry *dentry_cursor = inode->dentrys;
-    int cnt = 0;
-    while (dentry_cursor)
+    if (dir < 0 || dir >= inode->dentry_cnt)
+    {
+        return NULL;
+    }
+    return inode->dentrys[dir];
+}
+/**
+ * @brief 在目录中按名字查找目录项，调用者需持有目录inode的锁
+ *
+ * @param inode 目录inode
+ * @param fname 文件名
+ * @param can_load 未整体读入的索引目录是否按hash到磁盘上查找，需持有写锁
+ * @param dentry_out 输出找到的目录项，找不到为NULL
+ * @return int 读盘失败返回-NEWFS_ERROR_IO，此时不能断定该名字不存在
+ */
+int newfs_dir_find(struct newfs_inode *inode, const char *fname, boolean can_load,
+                   struct newfs_dentry **dentry_out)
+{
+    uint32_t hash = newfs_name_hash(fname);
+    int i;
+
+    /* 先扫紧凑的hash数组，hash相同时才去比较文件名 */
+    for (i = newfs_hash_scan(inode->hashes, 0, inode->dentry_cnt, hash); i < inode->dentry_cnt;
+         i = newfs_hash_scan(inode->hashes, i + 1, inode->dentry_cnt, hash))
     {
-        if (dir == cnt)
+        if (strcmp(inode->dentrys[i]->fname, fname) == 0)
         {
-            return dentry_cursor;
+            *dentry_out = inode->dentrys[i];
+            return NEWFS_ERROR_NONE;
         }
-        cnt++;
-        dentry_cursor = dentry_cursor->brother;
     }
-    return NULL;
+    *dentry_out = NULL;
+    if (can_load && !inode->is_complete)
+    {
+        return newfs_dx_lookup(inode, fname, dentry_out);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 目录项与子inode是否都已在内存中，此时readdir只需读锁
+ *
+ * @param inode 目录inode
+ * @return boolean
+ */
+boolean newfs_dir_is_loaded(struct newfs_inode *inode)
+{
+    return inode->is_complete && inode->unloaded_cnt == 0;
+}
+/**
+ * @brief 在目录中查找一项并装入其inode，调用者需共享持有tree_lock
+ *
+ * 先持读锁在内存中查找，要从磁盘装入目录项或子inode时换成写锁重查，期间可能已被别的线程装入
+ *
+ * @param inode 目录inode
+ * @param fname 文件名
+ * @param child_out 输出找到的目录项，其inode已装入；失败时为NULL
+ * @return int 确实不存在返回-NEWFS_ERROR_NOTFOUND，读目录项或子inode失败返回-NEWFS_ERROR_IO
+ */
+int newfs_dir_lookup(struct newfs_inode *inode, const char *fname, struct newfs_dentry **child_out)
+{
+    struct newfs_dentry *child;
+    int ret = NEWFS_ERROR_NONE;
+
+    NEWFS_INODE_RDLOCK(inode);
+    newfs_dir_find(inode, fname, FALSE, &child);
+    if ((child == NULL && !inode->is_complete) || (child != NULL && child->inode == NULL))
+    {
+        NEWFS_INODE_UNLOCK(inode);
+        NEWFS_INODE_WRLOCK(inode);
+        ret = newfs_dir_find(inode, fname, TRUE, &child);
+        if (child != NULL && child->inode == NULL)
+        {
+            child->inode = newfs_read_inode(child, child->ino);
+            if (child->inode)
+            {
+                newfs_cache_add(child->inode);
+                inode->unloaded_cnt--;
+            }
+            else
+            {
+                ret = -NEWFS_ERROR_IO;
+            }
+        }
+    }
+    else if (child != NULL)
+    {
+        newfs_cache_touch(child->inode);
+    }
+    NEWFS_INODE_UNLOCK(inode);
+    if (ret == NEWFS_ERROR_NONE && child == NULL)
+    {
+        ret = -NEWFS_ERROR_NOTFOUND;
+    }
+    *child_out = ret == NEWFS_ERROR_NONE ? child : NULL;
+    return ret;
+}
+/**
+ * @brief 在目录下新建一项，在父目录的写锁内重查重名，调用者需共享持有tree_lock
+ *
+ * @param parent 父目录的dentry
+ * @param fname 文件名
+ * @param ftype 文件类型
+ * @param dentry_out 输出新建的dentry，可为NULL
+ * @return int 重名返回-NEWFS_ERROR_EXISTS，无空闲inode返回-NEWFS_ERROR_NOSPACE，
+ *             查重时读盘失败返回-NEWFS_ERROR_IO
+ */
+int newfs_dir_create(struct newfs_dentry *parent, const char *fname, NEWFS_FILE_TYPE ftype,
+                     struct newfs_dentry **dentry_out)
+{
+    struct newfs_dentry *dentry;
+    int ret;
+
+    NEWFS_INODE_WRLOCK(parent->inode);
+    if ((ret = newfs_dir_find(parent->inode, fname, TRUE, &dentry)) != NEWFS_ERROR_NONE)
+    { /* 没能读到对应的叶块，无法确认不重名 */
+        NEWFS_INODE_UNLOCK(parent->inode);
+        return ret;
+    }
+    if (dentry != NULL)
+    { /* 查找之后、加锁之前被其他线程抢先创建 */
+        NEWFS_INODE_UNLOCK(parent->inode);
+        return -NEWFS_ERROR_EXISTS;
+    }
+    dentry = newfs_new_dentry(parent->inode, fname, ftype);
+    dentry->parent = parent;
+    if (newfs_alloc_inode(dentry) == NULL)
+    { /* 文件名已进了父目录的names，留到目录释放时一并回收 */
+        NEWFS_INODE_UNLOCK(parent->inode);
+        newfs_slab_free(&newfs_dentry_slab, dentry);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    newfs_alloc_dentry(parent->inode, dentry);
+    newfs_cache_add(dentry->inode);
+    parent->inode->mtime = parent->inode->ctime = dentry->inode->mtime;
+    newfs_mark_dirty(parent->inode);
+    NEWFS_INODE_UNLOCK(parent->inode);
+
+    if (dentry_out)
+    {
+        *dentry_out = dentry;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 由空闲计数填充文件系统统计，路径接口与低层接口的statfs共用，不扫描位图
+ *
+ * @param st 返回统计
+ */
+void newfs_fill_statfs(struct statvfs *st)
+{
+    memset(st, 0, sizeof(struct statvfs));
+    st->f_bsize = NEWFS_BLOCK_SZ();
+    st->f_frsize = NEWFS_BLOCK_SZ();
+    st->f_namemax = NEWFS_MAX_FILE_NAME;
+    pthread_mutex_lock(&newfs_super.bitmap_lock);
+    st->f_blocks = newfs_super.max_data;
+    st->f_bfree = st->f_bavail = newfs_super.free_data;
+    st->f_files = newfs_super.max_ino;
+    st->f_ffree = st->f_favail = newfs_super.free_ino;
+    pthread_mutex_unlock(&newfs_super.bitmap_lock);
+}
+/**
+ * @brief 由已加载inode的dentry填充文件属性，路径接口与低层接口的getattr、readdir共用
+ *
+ * @param dentry inode已加载的dentry
+ * @param newfs_stat 返回状态
+ * @return void
+ */
+void newfs_fill_stat(struct newfs_dentry *dentry, struct stat *newfs_stat)
+{
+    memset(newfs_stat, 0, sizeof(struct stat));
+    if (NEWFS_IS_DIR(dentry->inode))
+    {
+        newfs_stat->st_mode = S_IFDIR | NEWFS_DEFAULT_PERM;
+        newfs_stat->st_size = dentry->inode->size; /* 目录项记录的总长 */
+    }
+    else if (NEWFS_IS_REG(dentry->inode))
+    {
+        newfs_stat->st_mode = S_IFREG | NEWFS_DEFAULT_PERM;
+        newfs_stat->st_size = dentry->inode->size;
+    }
+    else if (NEWFS_IS_SYM_LINK(dentry->inode))
+    {
+        newfs_stat->st_mode = S_IFLNK | NEWFS_DEFAULT_PERM;
+        newfs_stat->st_size = dentry->inode->size;
+    }
+
+    newfs_stat->st_ino = dentry->ino;
+    newfs_stat->st_nlink = 1;
+    newfs_stat->st_uid = getuid();
+    newfs_stat->st_gid = getgid();
+    newfs_stat->st_atime = dentry->inode->atime;
+    newfs_stat->st_mtime = dentry->inode->mtime;
+    newfs_stat->st_ctime = dentry->inode->ctime;
+    newfs_stat->st_blksize = NEWFS_BLOCK_SZ();
+
+    if (dentry == newfs_super.root_dentry)
+    {
+        newfs_stat->st_size = newfs_super.sz_usage;
+        newfs_stat->st_blocks = NEWFS_DISK_SZ() / NEWFS_BLOCK_SZ();
+        newfs_stat->st_nlink = 2; /* !特殊，根目录link数为2 */
+    }
 }
 /**
  * @brief
@@ -394,13 +2723,15 @@ struct newfs_dentry *newfs_lookup(const char *path, boolean *is_find, boolean *i
 {
     struct newfs_dentry *dentry_cursor = newfs_super.root_dentry;
     struct newfs_dentry *dentry_ret = NULL;
+    struct newfs_dentry *child;
     struct newfs_inode *inode;
     int total_lvl = newfs_calc_lvl(path);
     int lvl = 0;
-    boolean is_hit;
     char *fname = NULL;
-    char *path_cpy = (char *)malloc(sizeof(path));
+    char *save_ptr = NULL;
+    char *path_cpy = (char *)malloc(strlen(path) + 1);
     *is_root = FALSE;
+    *is_find = FALSE;
     strcpy(path_cpy, path);
 
     if (total_lvl == 0)
@@ -409,72 +2740,148 @@ struct newfs_dentry *newfs_lookup(const char *path, boolean *is_find, boolean *i
         *is_root = TRUE;
         dentry_ret = newfs_super.root_dentry;
     }
-    fname = strtok(path_cpy, "/");
+    fname = strtok_r(path_cpy, "/", &save_ptr); /* 多线程下不能用strtok的静态状态 */
     while (fname)
     {
         lvl++;
-        if (dentry_cursor->inode == NULL)
-        { /* Cache机制 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
-        }
+        inode = dentry_cursor->inode; /* 根inode常驻，其余在上一层目录的锁内已装入 */
 
-        inode = dentry_cursor->inode;
-
-        if (NEWFS_IS_REG(inode) && lvl < total_lvl)
+        if (!NEWFS_IS_DIR(inode))
         {
             NEWFS_DBG("[%s] not a dir\n", __func__);
             dentry_ret = inode->dentry;
             break;
         }
-        if (NEWFS_IS_DIR(inode))
+
+        if (newfs_dir_lookup(inode, fname, &child) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] not found %s\n", __func__, fname);
+            dentry_ret = inode->dentry;
+            break;
+        }
+        if (lvl == total_lvl)
         {
-            dentry_cursor = inode->dentrys;
-            is_hit = FALSE;
+            *is_find = TRUE;
+            dentry_ret = child;
+            break;
+        }
+        dentry_cursor = child;
+        fname = strtok_r(NULL, "/", &save_ptr);
+    }
 
-            while (dentry_cursor)
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0)
-                {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
+    free(path_cpy);
+    return dentry_ret;
+}
+/**
+ * @brief 按设备大小计算布局并写入一个只含根目录的空文件系统，mkfs.newfs与首次挂载共用
+ *
+ * 设备末尾留出元数据日志区，其余按NEWFS_BLKS_PER_GROUP()块划分为若干块组，每组布局相同：
+ * | Super(1) | Inode Map(1) | DATA Map(1) | Inode(*) | DATA(*) |
+ * 第0组的超级块为主超级块，其余组存放格式化时的备份。inode数由bytes_per_inode决定；
+ * 末组不足以容纳元数据时舍弃。调用前需已打开设备并填好driver_fd、sz_disk、sz_io
+ *
+ * @param bytes_per_inode 每多少字节设备空间配一个inode
+ * @return int
+ */
+int newfs_format(int bytes_per_inode)
+{
+    struct newfs_super_d newfs_super_d;
+    struct newfs_dentry *root_dentry;
+    struct newfs_inode *root_inode;
+    int bits_per_blk = NEWFS_BLOCK_SZ() * UINT8_BITS;
+    int total_blks = NEWFS_DISK_SZ() / NEWFS_BLOCK_SZ();
+    int journal_blks = total_blks / 32;
+    int group_blks, meta_blks, inode_blks, last_blks, group;
+    int ret;
 
-            if (!is_hit)
-            {
-                *is_find = FALSE;
-                NEWFS_DBG("[%s] not found %s\n", __func__, fname);
-                dentry_ret = inode->dentry;
-                break;
-            }
+    if (bytes_per_inode < NEWFS_INODE_D_SZ)
+    {
+        return -NEWFS_ERROR_INVAL;
+    }
+    journal_blks = journal_blks < NEWFS_JOURNAL_MIN_BLKS ? NEWFS_JOURNAL_MIN_BLKS : journal_blks;
+    journal_blks = journal_blks > NEWFS_JOURNAL_MAX_BLKS ? NEWFS_JOURNAL_MAX_BLKS : journal_blks;
+    if (total_blks <= journal_blks)
+    {
+        NEWFS_DBG("[%s] device too small\n", __func__);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    total_blks -= journal_blks;
+    newfs_super.journal.offset = NEWFS_BLKS_SZ(total_blks);
+    newfs_super.journal.blks = journal_blks;
+    group_blks = total_blks < NEWFS_BLKS_PER_GROUP() ? total_blks : NEWFS_BLKS_PER_GROUP();
+    newfs_super.inodes_per_group = NEWFS_BLKS_SZ(group_blks) / bytes_per_inode;
+    newfs_super.inodes_per_group = NEWFS_ROUND_DOWN(newfs_super.inodes_per_group, NEWFS_INODE_PER_BLK());
+    if (newfs_super.inodes_per_group > bits_per_blk)
+    {
+        newfs_super.inodes_per_group = bits_per_blk;
+    }
+    inode_blks = newfs_super.inodes_per_group / NEWFS_INODE_PER_BLK();
+    meta_blks = 3 + inode_blks; /* 超级块 + 两个位图 + inode表 */
 
-            if (is_hit && lvl == total_lvl)
-            {
-                *is_find = TRUE;
-                dentry_ret = dentry_cursor;
-                break;
-            }
-        }
-        fname = strtok(NULL, "/");
+    newfs_super.blks_per_group = NEWFS_BLKS_PER_GROUP();
+    newfs_super.data_per_group = group_blks - meta_blks;
+    newfs_super.groups_cnt = total_blks / newfs_super.blks_per_group;
+    last_blks = total_blks % newfs_super.blks_per_group;
+    newfs_super.max_data = newfs_super.groups_cnt * newfs_super.data_per_group;
+    if (last_blks > meta_blks)
+    {
+        newfs_super.groups_cnt++;
+        newfs_super.max_data += last_blks - meta_blks;
+    }
+    if (newfs_super.inodes_per_group == 0 || newfs_super.data_per_group <= 0)
+    {
+        NEWFS_DBG("[%s] device too small\n", __func__);
+        return -NEWFS_ERROR_NOSPACE;
     }
 
-    if (dentry_ret->inode == NULL)
+    newfs_super.max_ino = newfs_super.groups_cnt * newfs_super.inodes_per_group;
+    newfs_super.sz_usage = 0;
+    newfs_super.map_inode_blks = newfs_super.groups_cnt;
+    newfs_super.map_data_blks = newfs_super.groups_cnt;
+    newfs_super.map_inode_offset = NEWFS_BLKS_SZ(1);
+    newfs_super.map_data_offset = NEWFS_BLKS_SZ(2);
+    newfs_super.inode_offset = NEWFS_BLKS_SZ(3);
+    newfs_super.data_offset = NEWFS_BLKS_SZ(meta_blks);
+    newfs_super.map_inode = (uint8_t *)calloc(1, NEWFS_BLKS_SZ(newfs_super.groups_cnt));
+    newfs_super.map_data = (uint8_t *)calloc(1, NEWFS_BLKS_SZ(newfs_super.groups_cnt));
+    newfs_super.free_ino = newfs_super.max_ino;
+    newfs_super.free_data = newfs_super.max_data;
+    newfs_super.group_dirty = (boolean *)malloc(newfs_super.groups_cnt * sizeof(boolean));
+    for (group = 0; group < newfs_super.groups_cnt; group++)
     {
-        dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+        newfs_super.group_dirty[group] = TRUE;
     }
 
-    return dentry_ret;
+    NEWFS_DBG("[%s] groups: %d, inodes: %d (%d per group), data blocks: %d (%d per group), journal: %d blocks\n",
+              __func__, newfs_super.groups_cnt, newfs_super.max_ino, newfs_super.inodes_per_group,
+              newfs_super.max_data, newfs_super.data_per_group, journal_blks);
+
+    /* 分配根节点，连同超级块与位图一并落盘 */
+    root_dentry = newfs_new_dentry(NULL, "/", NEWFS_DIR);
+    root_inode = newfs_alloc_inode(root_dentry);
+    ret = newfs_journal_format();
+    if (ret == NEWFS_ERROR_NONE)
+    {
+        ret = newfs_sync_fs();
+    }
+
+    newfs_fill_super_d(&newfs_super_d);
+    for (group = 1; group < newfs_super.groups_cnt && ret == NEWFS_ERROR_NONE; group++)
+    {
+        ret = newfs_driver_write(NEWFS_GROUP_OFS(group), (uint8_t *)&newfs_super_d,
+                                 sizeof(struct newfs_super_d));
+    }
+
+    newfs_free_inode(root_inode);
+    newfs_slab_free(&newfs_dentry_slab, root_dentry);
+    free(newfs_super.map_inode);
+    free(newfs_super.map_data);
+    free(newfs_super.group_dirty);
+    return ret;
 }
 /**
- * @brief 挂载newfs, Layout 如下
+ * @brief 挂载newfs，布局见newfs_format；设备上没有文件系统时按默认比例就地格式化
  *
- * Layout
- * | Super | Inode Map | DATA Map | Data |
- *
- * IO_SZ = BLK_SZ / 2
- *
- * 每个Inode占用1个Blk
  * @param options
  * @return int
  */
@@ -485,16 +2892,23 @@ int newfs_mount(struct custom_options options)
     struct newfs_super_d newfs_super_d;
     struct newfs_dentry *root_dentry;
     struct newfs_inode *root_inode;
-
-    int inode_num;
-    int data_num;
-    int map_inode_blks;
-    int map_data_blks;
-
-    int super_blks;
-    boolean is_init = FALSE;
+    int group;
 
     newfs_super.is_mounted = FALSE;
+    newfs_super.is_super_dirty = FALSE;
+    newfs_super.dirty_inodes = NULL;
+    newfs_super.dirty_cnt = 0;
+    newfs_super.lru_head = newfs_super.lru_tail = NULL;
+    newfs_super.cache_bytes = 0;
+    newfs_super.cache_budget = (long)options.cache_kb * 1024;
+    newfs_super.cache_kick = newfs_super.cache_budget;
+    memset(&newfs_super.journal, 0, sizeof(struct newfs_journal));
+    pthread_rwlock_init(&newfs_super.tree_lock, NULL);
+    pthread_mutex_init(&newfs_super.bitmap_lock, NULL);
+    pthread_mutex_init(&newfs_super.dirty_lock, NULL);
+    pthread_mutex_init(&newfs_super.cache_lock, NULL);
+    pthread_mutex_init(&newfs_super.driver_lock, NULL);
+    pthread_mutex_init(&newfs_super.writeback_lock, NULL);
 
     // driver_fd = open(options.device, O_RDWR);
     driver_fd = ddriver_open(options.device);
@@ -508,46 +2922,48 @@ int newfs_mount(struct custom_options options)
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE, &newfs_super.sz_disk);
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
 
-    root_dentry = new_dentry("/", NEWFS_DIR);
-
     if (newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)(&newfs_super_d),
                           sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
     {
         return -NEWFS_ERROR_IO;
     }
     /* 读取super */
+    if (newfs_super_d.magic_num == NEWFS_MAGIC_NUM && newfs_super_d.version != NEWFS_LAYOUT_VERSION)
+    { /* 旧格式的镜像，不能按当前布局解析 */
+        NEWFS_DBG("[%s] layout version %u != %d, reset the device first\n", __func__,
+                  newfs_super_d.version, NEWFS_LAYOUT_VERSION);
+        return -NEWFS_ERROR_INVAL;
+    }
     if (newfs_super_d.magic_num != NEWFS_MAGIC_NUM)
-    { /* 幻数无 */
-        /* 估算各部分大小 */
-        super_blks = 1;
-
-        inode_num = 512;
-        data_num = 2048;
-
-        map_inode_blks = 1;
-        map_data_blks = 1;
-
-        /* 布局layout */
-        newfs_super.max_ino = inode_num;
-        newfs_super.max_data = data_num;
-
-        newfs_super_d.map_inode_offset = NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(super_blks);
-        newfs_super_d.map_data_offset = newfs_super_d.map_inode_offset + NEWFS_BLKS_SZ(map_inode_blks);
-
-        newfs_super_d.inode_offset = newfs_super_d.map_data_offset + NEWFS_BLKS_SZ(map_data_blks);
-        newfs_super_d.data_offset = newfs_super_d.inode_offset + NEWFS_BLKS_SZ(inode_num);
-
-        newfs_super_d.map_inode_blks = map_inode_blks;
-        newfs_super_d.map_data_blks = map_data_blks;
-
-        newfs_super_d.sz_usage = 0;
-        newfs_super_d.max_ino = inode_num;
-        newfs_super_d.max_data = data_num;
-
-        NEWFS_DBG("inode map blocks: %d\n", map_inode_blks);
-        is_init = TRUE;
+    { /* 幻数无：空设备，未经mkfs.newfs格式化 */
+        NEWFS_DBG("[%s] no newfs on device, formatting\n", __func__);
+        if ((ret = newfs_format(NEWFS_DEFAULT_BYTES_PER_INODE)) != NEWFS_ERROR_NONE ||
+            newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)(&newfs_super_d),
+                              sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
+        {
+            return ret != NEWFS_ERROR_NONE ? ret : -NEWFS_ERROR_IO;
+        }
+    }
+    /* 先回放日志，超级块、位图与inode表都要按回放后的内容读 */
+    newfs_super.journal.offset = newfs_super_d.journal_offset;
+    newfs_super.journal.blks = newfs_super_d.journal_blks;
+    if ((ret = newfs_journal_load()) != NEWFS_ERROR_NONE ||
+        newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)(&newfs_super_d),
+                          sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
+    {
+        return ret != NEWFS_ERROR_NONE ? ret : -NEWFS_ERROR_IO;
     }
     newfs_super.sz_usage = newfs_super_d.sz_usage; /* 建立 in-memory 结构 */
+    newfs_super.max_ino = newfs_super_d.max_ino;
+    newfs_super.max_data = newfs_super_d.max_data;
+    newfs_super.free_ino = newfs_super_d.free_ino;
+    newfs_super.free_data = newfs_super_d.free_data;
+
+    newfs_super.groups_cnt = newfs_super_d.groups_cnt;
+    newfs_super.blks_per_group = newfs_super_d.blks_per_group;
+    newfs_super.inodes_per_group = newfs_super_d.inodes_per_group;
+    newfs_super.data_per_group = newfs_super_d.data_per_group;
+    newfs_super.group_dirty = (boolean *)calloc(newfs_super.groups_cnt, sizeof(boolean));
 
     newfs_super.map_inode = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
     newfs_super.map_data = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
@@ -560,23 +2976,18 @@ int newfs_mount(struct custom_options options)
     newfs_super.map_data_offset = newfs_super_d.map_data_offset;
     newfs_super.data_offset = newfs_super_d.data_offset;
 
-    if (newfs_driver_read(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode),
-                          NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE)
+    for (group = 0; group < newfs_super.groups_cnt; group++)
     {
-        return -NEWFS_ERROR_IO;
-    }
-    if (newfs_driver_read(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data),
-                          NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE)
-    {
-        return -NEWFS_ERROR_IO;
-    }
-
-    if (is_init)
-    { /* 分配根节点 */
-        root_inode = newfs_alloc_inode(root_dentry);
-        newfs_sync_inode(root_inode);
+        if (newfs_driver_read(NEWFS_GROUP_OFS(group) + newfs_super.map_inode_offset,
+                              newfs_super.map_inode + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE ||
+            newfs_driver_read(NEWFS_GROUP_OFS(group) + newfs_super.map_data_offset,
+                              newfs_super.map_data + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
     }
 
+    root_dentry = newfs_new_dentry(NULL, "/", NEWFS_DIR);
     root_inode = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
     root_dentry->inode = root_inode;
     newfs_super.root_dentry = root_dentry;
@@ -592,48 +3003,43 @@ int newfs_mount(struct custom_options options)
  */
 int newfs_umount()
 {
-    struct newfs_super_d newfs_super_d;
-
     if (!newfs_super.is_mounted)
     {
         return NEWFS_ERROR_NONE;
     }
 
-    newfs_sync_inode(newfs_super.root_dentry->inode); /* 从根节点向下刷写节点 */
-
-    newfs_super_d.magic_num = NEWFS_MAGIC_NUM;
-
-    newfs_super_d.map_inode_blks = newfs_super.map_inode_blks;
-    newfs_super_d.map_inode_offset = newfs_super.map_inode_offset;
-    newfs_super_d.inode_offset = newfs_super.inode_offset;
-
-    newfs_super_d.map_data_blks = newfs_super.map_data_blks;
-    newfs_super_d.map_data_offset = newfs_super.map_data_offset;
-    newfs_super_d.data_offset = newfs_super.data_offset;
-
-    newfs_super_d.sz_usage = newfs_super.sz_usage;
-
-    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d,
-                           sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
-    {
-        return -NEWFS_ERROR_IO;
-    }
-
-    if (newfs_driver_write(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode),
-                           NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE)
+    if (newfs_sync_fs() != NEWFS_ERROR_NONE || /* 只回写自上次同步后的修改 */
+        newfs_journal_checkpoint() != NEWFS_ERROR_NONE)
     {
         return -NEWFS_ERROR_IO;
     }
-    if (newfs_driver_write(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data),
-                           NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE)
+    /* 检查点归还了推迟释放的块，位图再提交一次，卸载后原位即是完整的镜像 */
+    if (newfs_super.is_super_dirty &&
+        (newfs_sync_fs() != NEWFS_ERROR_NONE || newfs_journal_checkpoint() != NEWFS_ERROR_NONE))
     {
         return -NEWFS_ERROR_IO;
     }
+    newfs_journal_destroy();
     // newfs_dump_map();
 
+    newfs_free_inode(newfs_super.root_dentry->inode); /* 此时已全部回写，整棵缓存树一并释放 */
+    newfs_slab_free(&newfs_dentry_slab, newfs_super.root_dentry);
+    newfs_super.root_dentry = NULL;
+    newfs_slab_destroy(&newfs_inode_slab);
+    newfs_slab_destroy(&newfs_dentry_slab);
+    newfs_super.lru_head = newfs_super.lru_tail = NULL;
+    newfs_super.cache_bytes = 0;
     free(newfs_super.map_inode);
     free(newfs_super.map_data);
+    free(newfs_super.group_dirty);
     ddriver_close(NEWFS_DRIVER());
+    newfs_super.is_mounted = FALSE;
+    pthread_rwlock_destroy(&newfs_super.tree_lock);
+    pthread_mutex_destroy(&newfs_super.bitmap_lock);
+    pthread_mutex_destroy(&newfs_super.dirty_lock);
+    pthread_mutex_destroy(&newfs_super.cache_lock);
+    pthread_mutex_destroy(&newfs_super.driver_lock);
+    pthread_mutex_destroy(&newfs_super.writeback_lock);
 
     return NEWFS_ERROR_NONE;
 }
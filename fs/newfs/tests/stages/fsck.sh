@@ -0,0 +1,84 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - fsck"
+
+# 目录超过一块即转为索引目录, 200个长名字的目录项足够
+ENTRY_CNT=200
+FSCK="$ROOT_PATH"/../build/fsck.newfs
+
+function entry_name () {
+    printf "entry_with_a_rather_long_name_%03d" "$1"
+}
+
+function check_indexed_ls () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    OUTPUT=($(ls "$_PARAM"))
+
+    if (( ${#OUTPUT[@]} != ENTRY_CNT )); then
+        fail "$_TEST_CASE: ls列出${#OUTPUT[@]}项, 应为${ENTRY_CNT}项"
+        return 1
+    fi
+    for ((i = 0; i < ENTRY_CNT; i++)); do
+        if [ ! -f "$_PARAM"/"$(entry_name $i)" ]; then
+            fail "$_TEST_CASE: $(entry_name $i)没有在$_PARAM中找到"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_fsck_clean () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    "$FSCK" "$HOME"/ddriver > /dev/null
+    RET=$?
+    if (( RET != 0 )); then
+        fail "$_TEST_CASE: fsck.newfs返回值为$RET, 应为0"
+        return 1
+    fi
+    return 0
+}
+
+function check_fsck_repair () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    # 超级块中第9个int为数据位图在组内的偏移, 把0号组数据位图中未用的一个字节置满
+    MAP_DATA_OFS=$(od -An -t d4 -j 32 -N 4 "$HOME"/ddriver | tr -d ' ')
+    printf '\377' | dd of="$HOME"/ddriver bs=1 seek=$((MAP_DATA_OFS + 64)) conv=notrunc 2> /dev/null
+
+    "$FSCK" -y "$HOME"/ddriver > /dev/null
+    RET=$?
+    if (( RET != 1 )); then
+        fail "$_TEST_CASE: 位图损坏后fsck.newfs -y返回值为$RET, 应为1"
+        return 1
+    fi
+    check_fsck_clean "$_PARAM" "$_TEST_CASE"
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/big
+for ((i = 0; i < ENTRY_CNT; i++)); do
+    touch_and_check "${MNTPOINT}"/big/"$(entry_name $i)"
+done
+
+sleep 1
+umount "${MNTPOINT}"
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - ls ${MNTPOINT}/big after remount"
+core_tester ls "${MNTPOINT}"/big check_indexed_ls "$TEST_CASE"
+
+sleep 1
+clean_mount
+
+TEST_CASE="case 8.2 - fsck.newfs on a clean image"
+core_tester ls "${MNTPOINT}" check_fsck_clean "$TEST_CASE"
+
+TEST_CASE="case 8.3 - fsck.newfs -y on a corrupted data bitmap"
+core_tester ls "${MNTPOINT}" check_fsck_repair "$TEST_CASE"
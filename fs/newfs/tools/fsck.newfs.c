@@ -0,0 +1,652 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super newfs_super;
+
+/**
+ * @brief 离线检查newfs镜像
+ *
+ * 用法: fsck.newfs [-y] [-j threads] <device>
+ *
+ * 先回放日志（不带-y时只在内存中回放，不写盘），之后：
+ * 1. 各工作线程按组领任务，每组的两张位图与整张inode表各用一次大块顺序读读入；
+ * 2. 各工作线程按目录领任务，读目录块（索引目录还有索引节点与叶块），收集目录项与占用的块；
+ * 3. 从根目录出发遍历，可达的inode及其引用的块构成应有的位图，与磁盘上的位图、空闲计数比对。
+ *
+ * 位图置位而不可达的inode为孤立inode，置位而无人引用的块为泄漏块（如事务提交后、检查点前
+ * 崩溃，待释放的块随内存丢失）。-y时写回重建的位图与空闲计数；目录损坏、块被重复引用等
+ * 只报告不修复，且有这类问题时不重建位图，以免释放只经损坏元数据可达的inode与块。
+ *
+ * 返回值沿用e2fsck：0无问题，1已全部修复，4有未修复的问题，8运行出错
+ */
+#define FSCK_OK 0
+#define FSCK_CORRECTED 1
+#define FSCK_UNCORRECTED 4
+#define FSCK_ERROR 8
+#define FSCK_MAX_THREADS 16
+#define FSCK_REPORT_MAX 32 /* 每类问题最多逐条打印这么多 */
+
+/* 阶段二读出的目录内容，下标为ino，各线程只写自己领到的目录 */
+struct fsck_dir
+{
+	int *children; /* 目录项指向的ino */
+	int child_cnt;
+	int child_max;
+	int *blocks; /* 目录占用的块：bno[]，索引目录另含中间节点与叶块 */
+	int blk_cnt;
+	int blk_max;
+	int bad; /* 无法解析的目录块数 */
+};
+
+/* 工作线程从next领下一个任务，直到cnt */
+struct fsck_work
+{
+	pthread_mutex_t lock;
+	int next;
+	int cnt;
+	int (*fn)(int);
+	int ret;
+};
+
+static struct newfs_inode_d *fsck_inodes; /* 整张inode表，下标为ino */
+static struct fsck_dir *fsck_dirs;
+static int *fsck_dir_inos; /* 阶段二的任务：位图中在用的目录 */
+static int fsck_dir_cnt;
+static uint8_t *fsck_want_inode; /* 由遍历重建的位图，布局同newfs_super.map_inode */
+static uint8_t *fsck_want_data;
+static int fsck_problems;   /* 重建位图与空闲计数可以修复的问题 */
+static int fsck_unfixable;  /* 只能报告的问题 */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-y] [-j threads] <device>\n", prog);
+}
+/**
+ * @brief 追加到动态数组，容量不足时翻倍
+ *
+ * @param arr
+ * @param cnt
+ * @param max
+ * @param val
+ */
+static void fsck_push(int **arr, int *cnt, int *max, int val)
+{
+	if (*cnt == *max)
+	{
+		*max = *max ? *max * 2 : 16;
+		*arr = (int *)realloc(*arr, *max * sizeof(int));
+	}
+	(*arr)[(*cnt)++] = val;
+}
+/**
+ * @brief 位图中第idx个对象对应的位，各组的位图各占一块
+ *
+ * @param map
+ * @param per_group 每组的对象数
+ * @param idx ino或bno
+ * @param mask 输出：该位在字节中的掩码
+ * @return uint8_t* 该位所在的字节
+ */
+static uint8_t *fsck_bit(uint8_t *map, int per_group, int idx, uint8_t *mask)
+{
+	int bit = idx % per_group;
+
+	*mask = (uint8_t)(0x1 << (bit % UINT8_BITS));
+	return map + NEWFS_BLKS_SZ((idx / per_group)) + bit / UINT8_BITS;
+}
+static boolean fsck_test(uint8_t *map, int per_group, int idx)
+{
+	uint8_t mask;
+	return (*fsck_bit(map, per_group, idx, &mask) & mask) != 0;
+}
+static void fsck_set(uint8_t *map, int per_group, int idx)
+{
+	uint8_t mask;
+	*fsck_bit(map, per_group, idx, &mask) |= mask;
+}
+/**
+ * @brief 工作线程：领任务直到做完，出错时记下并让其他线程尽快停下
+ *
+ * @param arg struct fsck_work*
+ * @return void*
+ */
+static void *fsck_worker(void *arg)
+{
+	struct fsck_work *work = (struct fsck_work *)arg;
+	int idx, ret;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&work->lock);
+		idx = work->ret == NEWFS_ERROR_NONE && work->next < work->cnt ? work->next++ : -1;
+		pthread_mutex_unlock(&work->lock);
+		if (idx < 0)
+		{
+			break;
+		}
+		if ((ret = work->fn(idx)) != NEWFS_ERROR_NONE)
+		{
+			pthread_mutex_lock(&work->lock);
+			work->ret = ret;
+			pthread_mutex_unlock(&work->lock);
+		}
+	}
+	return NULL;
+}
+/**
+ * @brief 用threads个线程对[0, cnt)逐个调用fn
+ *
+ * @param fn
+ * @param cnt
+ * @param threads
+ * @return int 任一任务的错误
+ */
+static int fsck_run(int (*fn)(int), int cnt, int threads)
+{
+	pthread_t tids[FSCK_MAX_THREADS];
+	struct fsck_work work;
+	int i;
+
+	pthread_mutex_init(&work.lock, NULL);
+	work.next = 0;
+	work.cnt = cnt;
+	work.fn = fn;
+	work.ret = NEWFS_ERROR_NONE;
+	threads = threads < cnt ? threads : cnt;
+	for (i = 1; i < threads; i++)
+	{
+		pthread_create(&tids[i], NULL, fsck_worker, &work);
+	}
+	fsck_worker(&work);
+	for (i = 1; i < threads; i++)
+	{
+		pthread_join(tids[i], NULL);
+	}
+	pthread_mutex_destroy(&work.lock);
+	return work.ret;
+}
+/**
+ * @brief 阶段一：读入一组的位图与inode表
+ *
+ * inode表在组内连续，整段一次读入，不逐个inode定位
+ *
+ * @param group
+ * @return int
+ */
+static int fsck_read_group(int group)
+{
+	int first = group * newfs_super.inodes_per_group;
+	int cnt = newfs_super.max_ino - first;
+
+	cnt = cnt < newfs_super.inodes_per_group ? cnt : newfs_super.inodes_per_group;
+	if (newfs_driver_read(NEWFS_GROUP_OFS(group) + newfs_super.map_inode_offset,
+						  newfs_super.map_inode + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE ||
+		newfs_driver_read(NEWFS_GROUP_OFS(group) + newfs_super.map_data_offset,
+						  newfs_super.map_data + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (cnt > 0 && newfs_driver_read(NEWFS_INO_OFS(first), (uint8_t *)(fsck_inodes + first),
+									 cnt * NEWFS_INODE_D_SZ) != NEWFS_ERROR_NONE)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 读一个数据块，块号越界时不读
+ *
+ * @param bno
+ * @param block
+ * @return boolean
+ */
+static boolean fsck_read_block(int bno, uint8_t *block)
+{
+	if (bno < 0 || bno >= newfs_super.max_data)
+	{
+		return FALSE;
+	}
+	return newfs_driver_read(NEWFS_DATA_OFS(bno), block, NEWFS_BLOCK_SZ()) == NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 解析一个目录块（普通目录的数据块或索引目录的叶块）中的目录项
+ *
+ * @param dir
+ * @param bno
+ * @param block 缓冲区
+ */
+static void fsck_read_leaf(struct fsck_dir *dir, int bno, uint8_t *block)
+{
+	struct newfs_dentry_d *dentry_d;
+	int offset = 0;
+
+	fsck_push(&dir->blocks, &dir->blk_cnt, &dir->blk_max, bno);
+	if (!fsck_read_block(bno, block))
+	{
+		dir->bad++;
+		return;
+	}
+	while (offset + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLOCK_SZ())
+	{
+		dentry_d = (struct newfs_dentry_d *)(block + offset);
+		if (!newfs_dentry_d_valid(dentry_d, offset))
+		{
+			dir->bad++;
+			return;
+		}
+		if (dentry_d->name_len > 0)
+		{
+			fsck_push(&dir->children, &dir->child_cnt, &dir->child_max, (int)dentry_d->ino);
+		}
+		offset += dentry_d->rec_len;
+	}
+}
+/**
+ * @brief 读索引节点并检查count与层数
+ *
+ * @param bno
+ * @param node
+ * @return boolean
+ */
+static boolean fsck_read_dx(int bno, struct newfs_dx_node *node)
+{
+	return fsck_read_block(bno, (uint8_t *)node) && node->count <= NEWFS_DX_LIMIT() &&
+		   node->levels < NEWFS_DX_MAX_LEVELS;
+}
+/**
+ * @brief 阶段二：读一个目录的全部目录块
+ *
+ * @param idx fsck_dir_inos的下标
+ * @return int
+ */
+static int fsck_read_dir(int idx)
+{
+	int ino = fsck_dir_inos[idx];
+	struct newfs_inode_d *inode_d = &fsck_inodes[ino];
+	struct fsck_dir *dir = &fsck_dirs[ino];
+	struct newfs_dx_node *root = (struct newfs_dx_node *)malloc(NEWFS_BLOCK_SZ());
+	struct newfs_dx_node *node = (struct newfs_dx_node *)malloc(NEWFS_BLOCK_SZ());
+	uint8_t *block = (uint8_t *)malloc(NEWFS_BLOCK_SZ());
+	int i, j, k;
+
+	if (inode_d->flags & NEWFS_INODE_FLAG_INDEX)
+	{
+		fsck_push(&dir->blocks, &dir->blk_cnt, &dir->blk_max, inode_d->bno[0]);
+		if (!fsck_read_dx(inode_d->bno[0], root))
+		{
+			dir->bad++;
+			goto out;
+		}
+		for (i = 0; i < root->count; i++)
+		{
+			if (root->levels == 0)
+			{
+				fsck_read_leaf(dir, root->entries[i].bno, block);
+				continue;
+			}
+			fsck_push(&dir->blocks, &dir->blk_cnt, &dir->blk_max, root->entries[i].bno);
+			if (!fsck_read_dx(root->entries[i].bno, node))
+			{
+				dir->bad++;
+				continue;
+			}
+			for (j = 0; j < node->count; j++)
+			{
+				fsck_read_leaf(dir, node->entries[j].bno, block);
+			}
+		}
+	}
+	else
+	{
+		for (k = 0; k < NEWFS_DATA_PER_FILE; k++)
+		{
+			if (inode_d->bno[k] != NEWFS_INVALID_BNO)
+			{
+				fsck_read_leaf(dir, inode_d->bno[k], block);
+			}
+		}
+	}
+out:
+	free(root);
+	free(node);
+	free(block);
+	return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 把一个块记入重建的数据位图
+ *
+ * @param ino 引用者
+ * @param bno
+ */
+static void fsck_claim_block(int ino, int bno)
+{
+	if (bno < 0 || bno >= newfs_super.max_data)
+	{
+		printf("inode %d: block %d out of range\n", ino, bno);
+		fsck_unfixable++;
+	}
+	else if (fsck_test(fsck_want_data, newfs_super.data_per_group, bno))
+	{
+		printf("inode %d: block %d claimed more than once\n", ino, bno);
+		fsck_unfixable++;
+	}
+	else
+	{
+		fsck_set(fsck_want_data, newfs_super.data_per_group, bno);
+	}
+}
+/**
+ * @brief 阶段三：从根目录广度优先遍历，重建两张位图
+ *
+ */
+static void fsck_walk()
+{
+	int *queue = (int *)malloc(newfs_super.max_ino * sizeof(int));
+	int head = 0, tail = 0;
+	int ino, child, i, k;
+	struct newfs_inode_d *inode_d;
+	struct fsck_dir *dir;
+
+	fsck_set(fsck_want_inode, newfs_super.inodes_per_group, NEWFS_ROOT_INO);
+	queue[tail++] = NEWFS_ROOT_INO;
+	while (head < tail)
+	{
+		ino = queue[head++];
+		inode_d = &fsck_inodes[ino];
+		if (inode_d->ino != (uint32_t)ino)
+		{ /* inode表项已损坏，其中的块号不可信 */
+			printf("inode %d: bad inode number %u\n", ino, inode_d->ino);
+			fsck_unfixable++;
+			continue;
+		}
+		if (inode_d->ftype == NEWFS_DIR)
+		{
+			dir = &fsck_dirs[ino];
+			for (i = 0; i < dir->blk_cnt; i++)
+			{
+				fsck_claim_block(ino, dir->blocks[i]);
+			}
+			if (dir->bad)
+			{
+				printf("directory %d: %d damaged blocks\n", ino, dir->bad);
+				fsck_unfixable++;
+			}
+			else if (dir->child_cnt != inode_d->dir_cnt)
+			{
+				printf("directory %d: %d entries, dir_cnt says %d\n", ino, dir->child_cnt, inode_d->dir_cnt);
+				fsck_unfixable++;
+			}
+			for (i = 0; i < dir->child_cnt; i++)
+			{
+				child = dir->children[i];
+				if (child < 0 || child >= newfs_super.max_ino)
+				{
+					printf("directory %d: entry points to inode %d out of range\n", ino, child);
+					fsck_unfixable++;
+				}
+				else if (fsck_test(fsck_want_inode, newfs_super.inodes_per_group, child))
+				{
+					printf("directory %d: inode %d linked more than once\n", ino, child);
+					fsck_unfixable++;
+				}
+				else
+				{
+					fsck_set(fsck_want_inode, newfs_super.inodes_per_group, child);
+					queue[tail++] = child;
+				}
+			}
+		}
+		else if (!(inode_d->flags & NEWFS_INODE_FLAG_INLINE))
+		{
+			for (k = 0; k < NEWFS_DATA_PER_FILE; k++)
+			{
+				if (inode_d->bno[k] != NEWFS_INVALID_BNO)
+				{
+					fsck_claim_block(ino, inode_d->bno[k]);
+				}
+			}
+		}
+	}
+	free(queue);
+}
+/**
+ * @brief 逐组比对磁盘上的位图与重建的位图
+ *
+ * @param have 磁盘上的位图
+ * @param want 重建的位图
+ * @param per_group
+ * @param cnt 对象总数
+ * @param extra 置位却无人引用时的说法
+ * @param dirty 输出：有差异的组
+ * @return int 差异位数
+ */
+static int fsck_compare(uint8_t *have, uint8_t *want, int per_group, int cnt,
+						const char *extra, boolean *dirty)
+{
+	int group, byte, bit, idx, bytes, diffs = 0;
+	uint8_t diff;
+
+	for (group = 0; group * per_group < cnt; group++)
+	{
+		bytes = (per_group + UINT8_BITS - 1) / UINT8_BITS;
+		for (byte = 0; byte < bytes; byte++)
+		{
+			diff = have[NEWFS_BLKS_SZ(group) + byte] ^ want[NEWFS_BLKS_SZ(group) + byte];
+			while (diff)
+			{
+				bit = __builtin_ctz(diff);
+				diff &= diff - 1;
+				idx = group * per_group + byte * UINT8_BITS + bit;
+				if (idx >= cnt || (byte * UINT8_BITS + bit) >= per_group)
+				{ /* 末尾的填充位，不管 */
+					continue;
+				}
+				dirty[group] = TRUE;
+				if (diffs++ < FSCK_REPORT_MAX)
+				{
+					printf("%s %d\n", (want[NEWFS_BLKS_SZ(group) + byte] >> bit) & 0x1 ? "unmarked in-use" : extra, idx);
+				}
+			}
+		}
+	}
+	if (diffs > FSCK_REPORT_MAX)
+	{
+		printf("... %d more\n", diffs - FSCK_REPORT_MAX);
+	}
+	return diffs;
+}
+
+int main(int argc, char **argv)
+{
+	struct newfs_super_d newfs_super_d;
+	boolean repair = FALSE;
+	boolean *dirty;
+	int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int opt, ret = FSCK_ERROR, ino, group, used_ino, used_data, replayed;
+
+	while ((opt = getopt(argc, argv, "yj:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'y':
+			repair = TRUE;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return FSCK_ERROR;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return FSCK_ERROR;
+	}
+	threads = threads < 1 ? 1 : threads > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : threads;
+
+	newfs_super.driver_fd = ddriver_open(argv[optind]);
+	if (newfs_super.driver_fd < 0)
+	{
+		fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[optind]);
+		return FSCK_ERROR;
+	}
+	ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE, &newfs_super.sz_disk);
+	ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
+	memset(&newfs_super.journal, 0, sizeof(struct newfs_journal));
+	pthread_mutex_init(&newfs_super.bitmap_lock, NULL);
+	pthread_mutex_init(&newfs_super.dirty_lock, NULL);
+	pthread_mutex_init(&newfs_super.cache_lock, NULL);
+	pthread_mutex_init(&newfs_super.driver_lock, NULL);
+
+	/* 与挂载相同：先回放日志，再按回放后的超级块取布局 */
+	newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, sizeof(struct newfs_super_d));
+	if (newfs_super_d.magic_num != NEWFS_MAGIC_NUM || newfs_super_d.version != NEWFS_LAYOUT_VERSION)
+	{
+		fprintf(stderr, "%s: %s is not a newfs image of layout version %d\n", argv[0], argv[optind],
+				NEWFS_LAYOUT_VERSION);
+		goto close;
+	}
+	newfs_super.journal.offset = newfs_super_d.journal_offset;
+	newfs_super.journal.blks = newfs_super_d.journal_blks;
+	if (repair)
+	{
+		replayed = newfs_journal_load();
+	}
+	else if ((replayed = newfs_journal_peek()) > 0)
+	{ /* 不修复时不写盘，回放的块只留在日志缓存中 */
+		printf("%s: %d journal transactions not yet on disk, checking as if replayed\n", argv[optind],
+			   replayed);
+	}
+	if (replayed < 0 ||
+		newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d,
+						  sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
+	{
+		fprintf(stderr, "%s: cannot replay journal\n", argv[0]);
+		goto close;
+	}
+	newfs_super.max_ino = newfs_super_d.max_ino;
+	newfs_super.max_data = newfs_super_d.max_data;
+	newfs_super.groups_cnt = newfs_super_d.groups_cnt;
+	newfs_super.blks_per_group = newfs_super_d.blks_per_group;
+	newfs_super.inodes_per_group = newfs_super_d.inodes_per_group;
+	newfs_super.data_per_group = newfs_super_d.data_per_group;
+	newfs_super.map_inode_blks = newfs_super_d.map_inode_blks;
+	newfs_super.map_inode_offset = newfs_super_d.map_inode_offset;
+	newfs_super.inode_offset = newfs_super_d.inode_offset;
+	newfs_super.map_data_blks = newfs_super_d.map_data_blks;
+	newfs_super.map_data_offset = newfs_super_d.map_data_offset;
+	newfs_super.data_offset = newfs_super_d.data_offset;
+
+	newfs_super.map_inode = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super.map_inode_blks));
+	newfs_super.map_data = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super.map_data_blks));
+	fsck_want_inode = (uint8_t *)calloc(newfs_super.map_inode_blks, NEWFS_BLOCK_SZ());
+	fsck_want_data = (uint8_t *)calloc(newfs_super.map_data_blks, NEWFS_BLOCK_SZ());
+	fsck_inodes = (struct newfs_inode_d *)calloc(newfs_super.max_ino, sizeof(struct newfs_inode_d));
+	fsck_dirs = (struct fsck_dir *)calloc(newfs_super.max_ino, sizeof(struct fsck_dir));
+	fsck_dir_inos = (int *)malloc(newfs_super.max_ino * sizeof(int));
+	dirty = (boolean *)calloc(newfs_super.groups_cnt, sizeof(boolean));
+
+	if (fsck_run(fsck_read_group, newfs_super.groups_cnt, threads) != NEWFS_ERROR_NONE)
+	{
+		fprintf(stderr, "%s: cannot read inode tables\n", argv[0]);
+		goto out;
+	}
+	if (fsck_inodes[NEWFS_ROOT_INO].ino != NEWFS_ROOT_INO || fsck_inodes[NEWFS_ROOT_INO].ftype != NEWFS_DIR)
+	{
+		fprintf(stderr, "%s: root inode is damaged\n", argv[0]);
+		ret = FSCK_UNCORRECTED;
+		goto out;
+	}
+	for (ino = 0; ino < newfs_super.max_ino; ino++)
+	{ /* 只有目录需要再读盘；不看位图，位图未置位而被引用的目录也要读出其目录项 */
+		if (fsck_inodes[ino].ino == (uint32_t)ino && fsck_inodes[ino].ftype == NEWFS_DIR)
+		{
+			fsck_dir_inos[fsck_dir_cnt++] = ino;
+		}
+	}
+	if (fsck_run(fsck_read_dir, fsck_dir_cnt, threads) != NEWFS_ERROR_NONE)
+	{
+		fprintf(stderr, "%s: cannot read directories\n", argv[0]);
+		goto out;
+	}
+
+	fsck_walk();
+	fsck_problems += fsck_compare(newfs_super.map_inode, fsck_want_inode, newfs_super.inodes_per_group,
+								  newfs_super.max_ino, "orphan inode", dirty);
+	fsck_problems += fsck_compare(newfs_super.map_data, fsck_want_data, newfs_super.data_per_group,
+								  newfs_super.max_data, "leaked block", dirty);
+	used_ino = 0;
+	used_data = 0;
+	for (group = 0; group < newfs_super.groups_cnt; group++)
+	{
+		used_ino += newfs_bitmap_count(fsck_want_inode + NEWFS_BLKS_SZ(group),
+									   newfs_super.inodes_per_group);
+		used_data += newfs_bitmap_count(fsck_want_data + NEWFS_BLKS_SZ(group),
+										newfs_super.data_per_group);
+	}
+	if (newfs_super_d.free_ino != newfs_super.max_ino - used_ino ||
+		newfs_super_d.free_data != newfs_super.max_data - used_data)
+	{
+		printf("free counts %d inodes, %d blocks; should be %d, %d\n", newfs_super_d.free_ino,
+			   newfs_super_d.free_data, newfs_super.max_ino - used_ino, newfs_super.max_data - used_data);
+		fsck_problems++;
+	}
+
+	if (repair && fsck_problems > 0 && fsck_unfixable > 0)
+	{ /* 损坏目录下的inode与块看起来也是孤立、泄漏的，此时重建位图会释放仍在用的数据 */
+		printf("%s: not rebuilding bitmaps while unfixable problems remain\n", argv[optind]);
+	}
+	else if (repair && fsck_problems > 0)
+	{
+		for (group = 0; group < newfs_super.groups_cnt; group++)
+		{
+			if (dirty[group] &&
+				(newfs_driver_write(NEWFS_GROUP_OFS(group) + newfs_super.map_inode_offset,
+									fsck_want_inode + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE ||
+				 newfs_driver_write(NEWFS_GROUP_OFS(group) + newfs_super.map_data_offset,
+									fsck_want_data + NEWFS_BLKS_SZ(group), NEWFS_BLOCK_SZ()) != NEWFS_ERROR_NONE))
+			{
+				fprintf(stderr, "%s: cannot write bitmaps\n", argv[0]);
+				goto out;
+			}
+		}
+		newfs_super_d.free_ino = newfs_super.max_ino - used_ino;
+		newfs_super_d.free_data = newfs_super.max_data - used_data;
+		if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d,
+							   sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
+		{
+			fprintf(stderr, "%s: cannot write superblock\n", argv[0]);
+			goto out;
+		}
+	}
+	printf("%s: %d/%d inodes, %d/%d blocks, %d problems%s, %d unfixable\n", argv[optind],
+		   used_ino, newfs_super.max_ino, used_data, newfs_super.max_data, fsck_problems,
+		   repair && fsck_problems > 0 && fsck_unfixable == 0 ? " fixed" : "", fsck_unfixable);
+	if (fsck_unfixable > 0 || (fsck_problems > 0 && !repair))
+	{
+		ret = FSCK_UNCORRECTED;
+	}
+	else
+	{
+		ret = fsck_problems > 0 ? FSCK_CORRECTED : FSCK_OK;
+	}
+out:
+	for (ino = 0; ino < newfs_super.max_ino; ino++)
+	{
+		free(fsck_dirs[ino].children);
+		free(fsck_dirs[ino].blocks);
+	}
+	free(fsck_dirs);
+	free(fsck_dir_inos);
+	free(fsck_inodes);
+	free(fsck_want_inode);
+	free(fsck_want_data);
+	free(newfs_super.map_inode);
+	free(newfs_super.map_data);
+	free(dirty);
+	newfs_journal_destroy();
+close:
+	ddriver_close(NEWFS_DRIVER());
+	return ret;
+}
@@ -0,0 +1,63 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super newfs_super;
+
+/**
+ * @brief 离线格式化newfs镜像
+ *
+ * 用法: mkfs.newfs [-i bytes-per-inode] <device>
+ *
+ * 按设备大小计算布局，大设备上inode表与位图随之扩展，挂载时不再需要格式化
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i bytes-per-inode] <device>\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int bytes_per_inode = NEWFS_DEFAULT_BYTES_PER_INODE;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "i:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'i':
+			bytes_per_inode = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	newfs_super.driver_fd = ddriver_open(argv[optind]);
+	if (newfs_super.driver_fd < 0)
+	{
+		fprintf(stderr, "%s: cannot open %s\n", argv[0], argv[optind]);
+		return 1;
+	}
+	ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE, &newfs_super.sz_disk);
+	ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
+	newfs_super.is_super_dirty = FALSE;
+	newfs_super.dirty_inodes = NULL;
+	pthread_mutex_init(&newfs_super.bitmap_lock, NULL);
+	pthread_mutex_init(&newfs_super.dirty_lock, NULL);
+	pthread_mutex_init(&newfs_super.cache_lock, NULL);
+	pthread_mutex_init(&newfs_super.driver_lock, NULL);
+
+	ret = newfs_format(bytes_per_inode);
+	ddriver_close(NEWFS_DRIVER());
+	if (ret != NEWFS_ERROR_NONE)
+	{
+		fprintf(stderr, "%s: format failed (%d)\n", argv[0], ret);
+		return 1;
+	}
+	return 0;
+}
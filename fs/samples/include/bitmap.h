@@ -5,7 +5,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <math.h>
+#include <string.h>
 #include <errno.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /*
 Create a bitmap with bitmap_size bits. The bitmap is stored in `bitmap` and the size, in bytes, is stores in `bitmap_size`, however, the function call will contain bits.
@@ -42,4 +48,9 @@ Get the first bit of `bitmap` that is unset, i.e, set to 0.
 */
 uint64_t get_first_unset_bit(uint8_t * bitmap, uint64_t bitmap_size); 
 
+/*
+Count the bits of `bitmap` that are set to 1, e.g. to report used blocks without a bit-by-bit loop.
+*/
+uint64_t count_set_bits(uint8_t * bitmap, uint64_t bitmap_size);
+
 #endif
\ No newline at end of file
@@ -15,8 +15,7 @@ int clear_bit(uint8_t ** bitmap, uint64_t bitno) {
     uint64_t index = bitno / 8;
     int bit_index = bitno % 8;
 
-    int val = (int)pow(2, bit_index);
-    (* bitmap)[index] = (* bitmap)[index] & ~(val);
+    (* bitmap)[index] = (* bitmap)[index] & ~(1 << bit_index);
 
     return 0;
 }
@@ -25,70 +24,73 @@ int set_bit(uint8_t ** bitmap, uint64_t bitno) {
     uint64_t index = bitno / 8;
     int bit_index = bitno % 8;
 
-    int val = (int)pow(2, bit_index);
-    (* bitmap)[index] = (* bitmap)[index] | (val);
+    (* bitmap)[index] = (* bitmap)[index] | (1 << bit_index);
 
     return 0;
 }
 
-uint64_t get_first_unset_bit(uint8_t * bitmap, uint64_t bitmap_size) {
-    uint64_t index = 0;
-    int bit_index = 0;
-    int val, found = 0;
-
-    while(index < bitmap_size) {
-        bit_index = 0;
-        while(bit_index < 8) {
-            val = (int)pow(2, bit_index);
-            
-            if( !(bitmap[index] & val) ) {
-                found = 1;
-                break;
-            }
-            bit_index++;
-        }
-
-        if(!found)
-            index++;
-        else
+/*
+Skip bytes equal to `fill` starting at `index`, 32/16 bytes at a time with AVX2/SSE2 and
+then 8 bytes at a time. Returns the first byte that differs, or `bitmap_size`.
+*/
+static uint64_t skip_bytes(uint8_t * bitmap, uint64_t index, uint64_t bitmap_size, uint8_t fill) {
+    uint64_t word, fill64 = fill ? ~0ULL : 0ULL;
+
+#if defined(__AVX2__)
+    const __m256i key = _mm256_set1_epi8((char)fill);
+    for(; index + 32 <= bitmap_size; index += 32) {
+        if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(bitmap + index)), key)) != -1)
+            break;
+    }
+#elif defined(__SSE2__)
+    const __m128i key = _mm_set1_epi8((char)fill);
+    for(; index + 16 <= bitmap_size; index += 16) {
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(bitmap + index)), key)) != 0xFFFF)
             break;
     }
+#endif
+    for(; index + 8 <= bitmap_size; index += 8) {
+        memcpy(&word, bitmap + index, sizeof(word));
+        if(word != fill64)
+            break;
+    }
+    while(index < bitmap_size && bitmap[index] == fill)
+        index++;
+
+    return index;
+}
+
+uint64_t get_first_unset_bit(uint8_t * bitmap, uint64_t bitmap_size) {
+    uint64_t index = skip_bytes(bitmap, 0, bitmap_size, 0xFF);
 
-    if(found)
-        return (index * 8 + bit_index);
+    if(index < bitmap_size)
+        return (index * 8 + __builtin_ctz((uint8_t)~bitmap[index]));
     else
         return -1;
 }
 
 uint64_t get_first_set_bit(uint8_t * bitmap, uint64_t bitmap_size) {
-    uint64_t index = 0;
-    int bit_index = 0;
-    int val, found = 0;
-
-    while(index < bitmap_size) {
-        bit_index = 0;
-        while(bit_index < 8) {
-            val = (int)pow(2, bit_index);
-            
-            if(bitmap[index] & val) {
-                found = 1;
-                break;
-            }
-            bit_index++;
-        }
-
-        if(!found)
-            index++;
-        else
-            break;
-    }
+    uint64_t index = skip_bytes(bitmap, 0, bitmap_size, 0x00);
 
-    if(found)
-        return (index * 8 + bit_index);
+    if(index < bitmap_size)
+        return (index * 8 + __builtin_ctz(bitmap[index]));
     else
         return -1;
 }
 
+uint64_t count_set_bits(uint8_t * bitmap, uint64_t bitmap_size) {
+    uint64_t index = 0, count = 0, word;
+
+    for(; index + 8 <= bitmap_size; index += 8) {
+        memcpy(&word, bitmap + index, sizeof(word));
+        count += __builtin_popcountll(word);
+    }
+    for(; index < bitmap_size; index++)
+        count += __builtin_popcount(bitmap[index]);
+
+    return count;
+}
+
 void print_bitmap(uint8_t * bitmap, uint64_t bitmap_size){
     printf("Little Endian\n");
     int index = 0, bit_index = 0;
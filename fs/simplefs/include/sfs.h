@@ -40,6 +40,11 @@ struct sfs_dentry* sfs_get_dentry(struct sfs_inode * inode, int dir);
 
 struct sfs_dentry* sfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 /******************************************************************************
+* SECTION: sfs_bitmap.c
+*******************************************************************************/
+int 			   sfs_bitmap_find(const uint8_t* map, int from, int cnt);
+int 			   sfs_bitmap_count(const uint8_t* map, int cnt);
+/******************************************************************************
 * SECTION: sfs.c
 *******************************************************************************/
 void* 			   sfs_init(struct fuse_conn_info *);
@@ -53,6 +58,8 @@ int   			   sfs_write(const char *, const char *, size_t, off_t,
 					         struct fuse_file_info *);
 int   			   sfs_read(const char *, char *, size_t, off_t,
 					        struct fuse_file_info *);
+int   			   sfs_write_buf(const char *, struct fuse_bufvec *, off_t,
+					             struct fuse_file_info *);
 int   			   sfs_unlink(const char *);
 int   			   sfs_rmdir(const char *);
 int   			   sfs_rename(const char *, const char *);
@@ -36,11 +36,14 @@ typedef enum sfs_file_type {
 #define SFS_ERROR_UNSUPPORTED   ENXIO
 #define SFS_ERROR_IO            EIO     /* Error Input/Output */
 #define SFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define SFS_ERROR_FBIG          EFBIG   /* Beyond Per-File Data */
 
 #define SFS_MAX_FILE_NAME       128
 #define SFS_INODE_PER_FILE      1
 #define SFS_DATA_PER_FILE       16
+#define SFS_DENTRY_CAP_MIN      8           /* Initial dentry array slots per dir, doubled when full */
 #define SFS_DEFAULT_PERM        0777
+#define SFS_MAX_XFER            "8192"      /* Max bytes per FUSE read/write request: one whole file */
 
 #define SFS_IOC_MAGIC           'S'
 #define SFS_IOC_SEEK            _IO(SFS_IOC_MAGIC, 0)
@@ -84,20 +87,21 @@ struct sfs_inode
     int                ino;                           /* 在inode位图中的下标 */
     int                size;                          /* 文件已占用空间 */
     char               target_path[SFS_MAX_FILE_NAME];/* store traget path when it is a symlink */
-    int                dir_cnt;
+    int                dir_cnt;                       /* dentrys中的目录项数 */
+    int                dentry_cap;
     struct sfs_dentry* dentry;                        /* 指向该inode的dentry */
-    struct sfs_dentry* dentrys;                       /* 所有目录项 */
+    struct sfs_dentry** dentrys;                      /* 所有目录项，按磁盘顺序连续存放 */
+    uint32_t*          hashes;                        /* 与dentrys一一对应的文件名hash */
     uint8_t*           data;           
 };  
 
 struct sfs_dentry
 {
-    char               fname[SFS_MAX_FILE_NAME];
-    struct sfs_dentry* parent;                        /* 父亲Inode的dentry */
-    struct sfs_dentry* brother;                       /* 兄弟 */
     int                ino;
-    struct sfs_inode*  inode;                         /* 指向inode */
     SFS_FILE_TYPE      ftype;
+    struct sfs_inode*  inode;                         /* 指向inode */
+    struct sfs_dentry* parent;                        /* 父亲Inode的dentry */
+    char               fname[SFS_MAX_FILE_NAME];
 };
 
 struct sfs_super
@@ -128,7 +132,7 @@ static inline struct sfs_dentry* new_dentry(char * fname, SFS_FILE_TYPE ftype) {
     dentry->ino     = -1;
     dentry->inode   = NULL;
     dentry->parent  = NULL;
-    dentry->brother = NULL;                                            
+    return dentry;
 }
 /******************************************************************************
 * SECTION: FS Specific Structure - Disk structure
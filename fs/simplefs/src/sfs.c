@@ -27,6 +27,7 @@ static struct fuse_operations operations = {
 	.mknod = sfs_mknod,							      /* 创建文件，touch相关 */
 	.write = sfs_write,								  /* 写入文件 */
 	.read = sfs_read,								  /* 读文件 */
+	.write_buf = sfs_write_buf,						  /* 写入文件，数据不经中间缓冲直接拷入文件 */
 	.utimens = sfs_utimens,							  /* 修改时间，忽略，避免touch报错 */
 	.truncate = sfs_truncate,						  /* 改变文件大小 */
 	.unlink = sfs_unlink,							  /* 删除文件 */
@@ -48,6 +49,13 @@ void* sfs_init(struct fuse_conn_info * conn_info) {
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	} 
+	/* 大请求与splice：一次回调即可读写整个文件 */
+	if (conn_info->capable & FUSE_CAP_BIG_WRITES) {
+		conn_info->want |= FUSE_CAP_BIG_WRITES;
+	}
+	if (conn_info->capable & FUSE_CAP_SPLICE_READ) {
+		conn_info->want |= FUSE_CAP_SPLICE_READ;
+	}
 	return NULL;
 }
 
@@ -234,6 +242,13 @@ int sfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		return -SFS_ERROR_SEEK;
 	}
 
+	if (offset >= SFS_BLKS_SZ(SFS_DATA_PER_FILE)) {
+		return -SFS_ERROR_FBIG;
+	}
+	if (offset + size > SFS_BLKS_SZ(SFS_DATA_PER_FILE)) {
+		size = SFS_BLKS_SZ(SFS_DATA_PER_FILE) - offset;
+	}
+
 	memcpy(inode->data + offset, buf, size);
 	inode->size = offset + size > inode->size ? offset + size : inode->size;
 	
@@ -269,10 +284,61 @@ int sfs_read(const char* path, char* buf, size_t size, off_t offset,
 		return -SFS_ERROR_SEEK;
 	}
 
+	if (offset + size > inode->size) {
+		size = inode->size - offset;
+	}
+
 	memcpy(buf, inode->data + offset, size);
 
 	return size;			   
 }
+/**
+ * @brief 写入文件，内核以splice送来的数据由fuse_buf_copy直接读入inode->data
+ * 
+ * @param path 
+ * @param buf 
+ * @param offset 
+ * @param fi 
+ * @return int 
+ */
+int sfs_write_buf(const char* path, struct fuse_bufvec *buf, off_t offset,
+		          struct fuse_file_info* fi) {
+    boolean	is_find, is_root;
+	struct sfs_dentry* dentry = sfs_lookup(path, &is_find, &is_root);
+	struct sfs_inode*  inode;
+	size_t size = fuse_buf_size(buf);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	ssize_t ret;
+	
+	if (is_find == FALSE) {
+		return -SFS_ERROR_NOTFOUND;
+	}
+
+	inode = dentry->inode;
+	
+	if (SFS_IS_DIR(inode)) {
+		return -SFS_ERROR_ISDIR;	
+	}
+
+	if (inode->size < offset) {
+		return -SFS_ERROR_SEEK;
+	}
+
+	if (offset >= SFS_BLKS_SZ(SFS_DATA_PER_FILE)) {
+		return -SFS_ERROR_FBIG;
+	}
+	if (offset + size > SFS_BLKS_SZ(SFS_DATA_PER_FILE)) {
+		dst.buf[0].size = SFS_BLKS_SZ(SFS_DATA_PER_FILE) - offset;
+	}
+
+	dst.buf[0].mem = inode->data + offset;
+	ret = fuse_buf_copy(&dst, buf, 0);
+	if (ret > 0) {
+		inode->size = offset + ret > inode->size ? offset + ret : inode->size;
+	}
+	
+	return ret;
+}
 /**
  * @brief 
  * 
@@ -528,6 +594,9 @@ int main(int argc, char **argv)
 		fuse_opt_add_arg(&args, "--help");
 		args.argv[0][0] = '\0';
 	}
+
+	/* 默认每次只下发4KiB，放大到128KiB，整个文件一次读写完 */
+	fuse_opt_add_arg(&args, "-obig_writes,max_write=" SFS_MAX_XFER ",max_read=" SFS_MAX_XFER);
 	
 	ret = fuse_main(args.argc, args.argv, &operations, NULL);
 	fuse_opt_free_args(&args);
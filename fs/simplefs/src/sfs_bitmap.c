@@ -0,0 +1,96 @@
+#include "../include/sfs.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief 从byte开始跳过全占用（0xFF）的字节，先按向量、再按64位字成段比较
+ * 
+ * @param map 
+ * @param byte 起始字节
+ * @param end 结束字节（不含）
+ * @return int 第一个有空闲位的字节，没有则返回end
+ */
+static int sfs_bitmap_skip_full(const uint8_t* map, int byte, int end) {
+    uint64_t word;
+
+#if defined(__AVX2__)
+    const __m256i full = _mm256_set1_epi8((char)0xFF);
+    for (; byte + 32 <= end; byte += 32) {
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(map + byte)), full)) != -1) {
+            break;
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i full = _mm_set1_epi8((char)0xFF);
+    for (; byte + 16 <= end; byte += 16) {
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(map + byte)), full)) != 0xFFFF) {
+            break;
+        }
+    }
+#endif
+    for (; byte + 8 <= end; byte += 8) {
+        memcpy(&word, map + byte, sizeof(word));
+        if (word != ~0ULL) {
+            break;
+        }
+    }
+    while (byte < end && map[byte] == 0xFF) {
+        byte++;
+    }
+    return byte;
+}
+/**
+ * @brief 在位图的[from, cnt)位中找第一个空闲位
+ * 
+ * @param map 
+ * @param from 
+ * @param cnt 
+ * @return int 空闲位下标，没有则返回-1
+ */
+int sfs_bitmap_find(const uint8_t* map, int from, int cnt) {
+    int     end  = (cnt + UINT8_BITS - 1) / UINT8_BITS;
+    int     byte = from / UINT8_BITS;
+    int     bit;
+    uint8_t free_bits;
+
+    if (from >= cnt) {
+        return -1;
+    }
+    free_bits = (uint8_t)(~map[byte] & (0xFF << (from % UINT8_BITS)));
+    if (free_bits == 0) {
+        byte = sfs_bitmap_skip_full(map, byte + 1, end);
+        if (byte == end) {
+            return -1;
+        }
+        free_bits = (uint8_t)~map[byte];
+    }
+    bit = byte * UINT8_BITS + __builtin_ctz(free_bits);
+    return bit < cnt ? bit : -1;
+}
+/**
+ * @brief 位图前cnt位中已占用的位数
+ * 
+ * @param map 
+ * @param cnt 
+ * @return int 
+ */
+int sfs_bitmap_count(const uint8_t* map, int cnt) {
+    int      bytes = cnt / UINT8_BITS;
+    int      byte = 0, used = 0;
+    uint64_t word;
+
+    for (; byte + 8 <= bytes; byte += 8) {
+        memcpy(&word, map + byte, sizeof(word));
+        used += __builtin_popcountll(word);
+    }
+    for (; byte < bytes; byte++) {
+        used += __builtin_popcount(map[byte]);
+    }
+    if (cnt % UINT8_BITS) {
+        used += __builtin_popcount(map[bytes] & ((0x1 << (cnt % UINT8_BITS)) - 1));
+    }
+    return used;
+}
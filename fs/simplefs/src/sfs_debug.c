@@ -7,6 +7,8 @@ void sfs_dump_map() {
     int byte_cursor = 0;
     int bit_cursor = 0;
 
+    printf("inode used %d/%d\n", sfs_bitmap_count(sfs_super.map_inode, sfs_super.max_ino), sfs_super.max_ino);
+
     for (byte_cursor = 0; byte_cursor < SFS_BLKS_SZ(sfs_super.map_inode_blks); 
          byte_cursor+=4)
     {
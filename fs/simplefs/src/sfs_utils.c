@@ -1,4 +1,7 @@
 #include "../include/sfs.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 extern struct sfs_super      sfs_super; 
 extern struct custom_options sfs_options;
@@ -95,56 +98,109 @@ int sfs_driver_write(int offset, uint8_t *in_content, int size) {
     return SFS_ERROR_NONE;
 }
 /**
- * @brief 为一个inode分配dentry，采用头插法
+ * @brief 文件名hash（FNV-1a）
+ * 
+ * @param fname 
+ * @return uint32_t 
+ */
+static uint32_t sfs_name_hash(const char* fname) {
+    uint32_t hash = 2166136261u;
+    while (*fname) {
+        hash = (hash ^ (uint8_t)*fname++) * 16777619u;
+    }
+    return hash;
+}
+/**
+ * @brief 在hashes[from, cnt)中找第一个等于hash的下标，有SSE2时一次比较4个
+ * 
+ * @param hashes 
+ * @param from 
+ * @param cnt 
+ * @param hash 
+ * @return int 找不到返回cnt
+ */
+static int sfs_hash_scan(const uint32_t* hashes, int from, int cnt, uint32_t hash) {
+#if defined(__SSE2__)
+    __m128i key = _mm_set1_epi32((int)hash);
+    int     mask;
+
+    for (; from + 4 <= cnt; from += 4) {
+        mask = _mm_movemask_ps(_mm_castsi128_ps(
+               _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(hashes + from)), key)));
+        if (mask) {
+            return from + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; from < cnt; from++) {
+        if (hashes[from] == hash) {
+            return from;
+        }
+    }
+    return cnt;
+}
+/**
+ * @brief 为一个inode分配dentry，追加在dentrys末尾，数组满时容量翻倍
  * 
  * @param inode 
  * @param dentry 
  * @return int 
  */
 int sfs_alloc_dentry(struct sfs_inode* inode, struct sfs_dentry* dentry) {
-    if (inode->dentrys == NULL) {
-        inode->dentrys = dentry;
-    }
-    else {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+    if (inode->dir_cnt == inode->dentry_cap) {
+        inode->dentry_cap = inode->dentry_cap ? inode->dentry_cap * 2 : SFS_DENTRY_CAP_MIN;
+        inode->dentrys    = (struct sfs_dentry **)realloc(inode->dentrys, 
+                            inode->dentry_cap * sizeof(struct sfs_dentry *));
+        inode->hashes     = (uint32_t *)realloc(inode->hashes, inode->dentry_cap * sizeof(uint32_t));
     }
+    inode->dentrys[inode->dir_cnt] = dentry;
+    inode->hashes[inode->dir_cnt]  = sfs_name_hash(dentry->fname);
     inode->dir_cnt++;
     return inode->dir_cnt;
 }
 /**
- * @brief 将dentry从inode的dentrys中取出
+ * @brief 将dentry从inode的dentrys中取出，其后的目录项前移以保持顺序
  * 
  * @param inode 
  * @param dentry 
  * @return int 
  */
 int sfs_drop_dentry(struct sfs_inode * inode, struct sfs_dentry * dentry) {
-    boolean is_find = FALSE;
-    struct sfs_dentry* dentry_cursor;
-    dentry_cursor = inode->dentrys;
-    
-    if (dentry_cursor == dentry) {
-        inode->dentrys = dentry->brother;
-        is_find = TRUE;
-    }
-    else {
-        while (dentry_cursor)
-        {
-            if (dentry_cursor->brother == dentry) {
-                dentry_cursor->brother = dentry->brother;
-                is_find = TRUE;
-                break;
-            }
-            dentry_cursor = dentry_cursor->brother;
+    int i;
+
+    for (i = 0; i < inode->dir_cnt; i++) {
+        if (inode->dentrys[i] == dentry) {
+            break;
         }
     }
-    if (!is_find) {
+    if (i == inode->dir_cnt) {
         return -SFS_ERROR_NOTFOUND;
     }
+    memmove(inode->dentrys + i, inode->dentrys + i + 1, 
+            (inode->dir_cnt - i - 1) * sizeof(struct sfs_dentry *));
+    memmove(inode->hashes + i, inode->hashes + i + 1, (inode->dir_cnt - i - 1) * sizeof(uint32_t));
     inode->dir_cnt--;
     return inode->dir_cnt;
 }
+/**
+ * @brief 在目录中按名字查找目录项，先扫hash数组，hash相同时才比较文件名
+ * 
+ * @param inode 目录inode
+ * @param fname 
+ * @return struct sfs_dentry* 找不到返回NULL
+ */
+static struct sfs_dentry* sfs_dir_find(struct sfs_inode* inode, const char* fname) {
+    uint32_t hash = sfs_name_hash(fname);
+    int      i;
+
+    for (i = sfs_hash_scan(inode->hashes, 0, inode->dir_cnt, hash); i < inode->dir_cnt;
+         i = sfs_hash_scan(inode->hashes, i + 1, inode->dir_cnt, hash)) {
+        if (strcmp(inode->dentrys[i]->fname, fname) == 0) {
+            return inode->dentrys[i];
+        }
+    }
+    return NULL;
+}
 /**
  * @brief 分配一个inode，占用位图
  * 
@@ -153,30 +209,12 @@ int sfs_drop_dentry(struct sfs_inode * inode, struct sfs_dentry * dentry) {
  */
 struct sfs_inode* sfs_alloc_inode(struct sfs_dentry * dentry) {
     struct sfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find_free_entry = FALSE;
-
-    for (byte_cursor = 0; byte_cursor < SFS_BLKS_SZ(sfs_super.map_inode_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((sfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                sfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
-    }
+    int ino_cursor  = sfs_bitmap_find(sfs_super.map_inode, 0, sfs_super.max_ino);
 
-    if (!is_find_free_entry || ino_cursor == sfs_super.max_ino)
+    if (ino_cursor < 0)
         return -SFS_ERROR_NOSPACE;
+                                                      /* 当前ino_cursor位置空闲 */
+    sfs_super.map_inode[ino_cursor / UINT8_BITS] |= (0x1 << (ino_cursor % UINT8_BITS));
 
     inode = (struct sfs_inode*)malloc(sizeof(struct sfs_inode));
     inode->ino  = ino_cursor; 
@@ -188,7 +226,9 @@ struct sfs_inode* sfs_alloc_inode(struct sfs_dentry * dentry) {
     inode->dentry = dentry;
     
     inode->dir_cnt = 0;
+    inode->dentry_cap = 0;
     inode->dentrys = NULL;
+    inode->hashes = NULL;
     
     if (SFS_IS_REG(inode)) {
         inode->data = (uint8_t *)malloc(SFS_BLKS_SZ(SFS_DATA_PER_FILE));
@@ -206,6 +246,7 @@ int sfs_sync_inode(struct sfs_inode * inode) {
     struct sfs_inode_d  inode_d;
     struct sfs_dentry*  dentry_cursor;
     struct sfs_dentry_d dentry_d;
+    int i;
     int ino             = inode->ino;
     inode_d.ino         = ino;
     inode_d.size        = inode->size;
@@ -222,10 +263,10 @@ int sfs_sync_inode(struct sfs_inode * inode) {
                                                       /* Cycle 1: 写 INODE */
                                                       /* Cycle 2: 写 数据 */
     if (SFS_IS_DIR(inode)) {                          
-        dentry_cursor = inode->dentrys;
         offset        = SFS_DATA_OFS(ino);
-        while (dentry_cursor != NULL)
+        for (i = 0; i < inode->dir_cnt; i++)
         {
+            dentry_cursor = inode->dentrys[i];
             memcpy(dentry_d.fname, dentry_cursor->fname, SFS_MAX_FILE_NAME);
             dentry_d.ftype = dentry_cursor->ftype;
             dentry_d.ino = dentry_cursor->ino;
@@ -239,7 +280,6 @@ int sfs_sync_inode(struct sfs_inode * inode) {
                 sfs_sync_inode(dentry_cursor->inode);
             }
 
-            dentry_cursor = dentry_cursor->brother;
             offset += sizeof(struct sfs_dentry_d);
         }
     }
@@ -281,48 +321,27 @@ int sfs_sync_inode(struct sfs_inode * inode) {
  * @return int 
  */
 int sfs_drop_inode(struct sfs_inode * inode) {
-    struct sfs_dentry*  dentry_cursor;
     struct sfs_dentry*  dentry_to_free;
     struct sfs_inode*   inode_cursor;
 
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find = FALSE;
-
     if (inode == sfs_super.root_dentry->inode) {
         return SFS_ERROR_INVAL;
     }
 
     if (SFS_IS_DIR(inode)) {
-        dentry_cursor = inode->dentrys;
-                                                      /* 递归向下drop */
-        while (dentry_cursor)
+                                                      /* 递归向下drop，从末尾取免去前移 */
+        while (inode->dir_cnt > 0)
         {   
-            inode_cursor = dentry_cursor->inode;
+            dentry_to_free = inode->dentrys[inode->dir_cnt - 1];
+            inode_cursor = dentry_to_free->inode;
             sfs_drop_inode(inode_cursor);
-            sfs_drop_dentry(inode, dentry_cursor);
-            dentry_to_free = dentry_cursor;
-            dentry_cursor = dentry_cursor->brother;
+            sfs_drop_dentry(inode, dentry_to_free);
             free(dentry_to_free);
         }
     }
     else if (SFS_IS_REG(inode) || SFS_IS_SYM_LINK(inode)) {
-        for (byte_cursor = 0; byte_cursor < SFS_BLKS_SZ(sfs_super.map_inode_blks); 
-            byte_cursor++)                            /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (ino_cursor == inode->ino) {
-                     sfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                     is_find = TRUE;
-                     break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE) {
-                break;
-            }
-        }
+                                                      /* 调整inodemap */
+        sfs_super.map_inode[inode->ino / UINT8_BITS] &= (uint8_t)(~(0x1 << (inode->ino % UINT8_BITS)));
         if (inode->data)
             free(inode->data);
         free(inode);
@@ -352,7 +371,9 @@ struct sfs_inode* sfs_read_inode(struct sfs_dentry * dentry, int ino) {
     inode->size = inode_d.size;
     memcpy(inode->target_path, inode_d.target_path, SFS_MAX_FILE_NAME);
     inode->dentry = dentry;
+    inode->dentry_cap = 0;
     inode->dentrys = NULL;
+    inode->hashes = NULL;
     if (SFS_IS_DIR(inode)) {
         dir_cnt = inode_d.dir_cnt;
         for (i = 0; i < dir_cnt; i++)
@@ -387,17 +408,10 @@ struct sfs_inode* sfs_read_inode(struct sfs_dentry * dentry, int ino) {
  * @return struct sfs_dentry* 
  */
 struct sfs_dentry* sfs_get_dentry(struct sfs_inode * inode, int dir) {
-    struct sfs_dentry* dentry_cursor = inode->dentrys;
-    int    cnt = 0;
-    while (dentry_cursor)
-    {
-        if (dir == cnt) {
-            return dentry_cursor;
-        }
-        cnt++;
-        dentry_cursor = dentry_cursor->brother;
+    if (dir < 0 || dir >= inode->dir_cnt) {
+        return NULL;
     }
-    return NULL;
+    return inode->dentrys[dir];
 }
 /**
  * @brief 
@@ -447,17 +461,8 @@ struct sfs_dentry* sfs_lookup(const char * path, boolean* is_find, boolean* is_r
             break;
         }
         if (SFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
+            dentry_cursor = sfs_dir_find(inode, fname);
+            is_hit        = dentry_cursor != NULL;
             
             if (!is_hit) {
                 *is_find = FALSE;